@@ -5,52 +5,174 @@
 #endif
 #include <math.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 ch_string ch_str_new(char const *data) {
+    return ch_str_new_len(data, strlen(data));
+}
+
+// Backing store of shared strings, `data` points at `chars`
+typedef struct {
+    size_t refs;
+    char chars[];
+} ch_str_block;
+
+#define CH_STR_FLAGS ((size_t)0xFF << (8 * (sizeof(size_t) - 1)))
+
+static char ch_str_is_shared(ch_string const *str) {
+    return (str->small.tag & (CH_STR_INLINE_BIT | CH_STR_SHARED_BIT)) ==
+           CH_STR_SHARED_BIT;
+}
+
+static char ch_str_is_static(ch_string const *str) {
+    return (str->small.tag & (CH_STR_INLINE_BIT | CH_STR_STATIC_BIT)) ==
+           CH_STR_STATIC_BIT;
+}
+
+static ch_str_block *ch_str_block_of(ch_string const *str) {
+    return (ch_str_block *)(str->data - offsetof(ch_str_block, chars));
+}
+
+static size_t ch_str_cap(ch_string const *str) {
+    return str->size & ~CH_STR_FLAGS;
+}
+
+static void ch_str_set_cap(ch_string *str, size_t size) {
+    str->size = size;
+    str->small.tag |= CH_STR_SHARED_BIT;
+}
+
+// Empty shared string with room for `size` bytes, terminator included
+static ch_string ch_str_block_new(size_t size) {
+    ch_str_block *block = malloc(sizeof(ch_str_block) + size);
+    if (block == NULL) {
+        printf("ERR: Out of memory\n");
+        exit(1);
+    }
+    block->refs = 1;
+    block->chars[0] = 0;
+
     ch_string str;
-    size_t len = strlen(data);
-    str.data = malloc(len + 1);
-    strcpy(str.data, data);
-    str.len = len;
-    str.size = len + 1;
+    str.data = block->chars;
+    str.len = 0;
+    ch_str_set_cap(&str, size);
     return str;
 }
 
-ch_string ch_str_alloc(size_t len) {
+ch_string ch_str_new_len(char const *data, size_t len) {
     ch_string str;
-    str.size = len + 1;
-    str.len = 0;
-    str.data = malloc(len + 1);
-    str.data[0] = 0;
+    if (len <= CH_STR_INLINE) {
+        memcpy(str.small.buf, data, len);
+        str.small.buf[len] = 0;
+        str.small.tag = CH_STR_INLINE_BIT | len;
+        return str;
+    }
+    str = ch_str_block_new(len + 1);
+    memcpy(str.data, data, len);
+    str.data[len] = 0;
+    str.len = len;
     return str;
 }
 
-void ch_str_push(ch_string *str, char c) {
-    if (str->len + 1 >= str->size) {
-        str->size = 3 * str->size / 2 + 1;
-        str->data = realloc(str->data, str->size);
+ch_string ch_str_alloc(size_t len) { return ch_str_block_new(len + 1); }
+
+// Ensures room for `len` bytes and the terminator in a buffer owned by `str`
+// alone, spilling to the heap once the inline buffer is outgrown
+static char *ch_str_reserve(ch_string *str, size_t len, size_t size) {
+    if (size < len + 1) {
+        size = len + 1;
     }
-    str->data[str->len] = c;
-    str->data[str->len + 1] = 0;
-    ++str->len;
+    if (ch_str_is_inline(str)) {
+        if (len <= CH_STR_INLINE) {
+            return str->small.buf;
+        }
+        size_t old_len = ch_str_len(str);
+        ch_string heap = ch_str_block_new(size);
+        memcpy(heap.data, str->small.buf, old_len + 1);
+        heap.len = old_len;
+        *str = heap;
+    } else if (ch_str_is_static(str) ||
+               (ch_str_is_shared(str) && ch_str_block_of(str)->refs > 1)) {
+        size_t cap = ch_str_cap(str);
+        ch_string own = ch_str_block_new(len + 1 > cap ? size : cap);
+        memcpy(own.data, str->data, str->len);
+        own.data[str->len] = 0;
+        own.len = str->len;
+        if (ch_str_is_shared(str)) {
+            ch_str_block_of(str)->refs--;
+        }
+        *str = own;
+    } else if (len + 1 > ch_str_cap(str)) {
+        if (ch_str_is_shared(str)) {
+            ch_str_block *block =
+                realloc(ch_str_block_of(str), sizeof(ch_str_block) + size);
+            str->data = block->chars;
+            ch_str_set_cap(str, size);
+        } else {
+            str->size = size;
+            str->data = realloc(str->data, str->size);
+        }
+    }
+    return str->data;
+}
+
+static void ch_str_set_len(ch_string *str, size_t len) {
+    if (ch_str_is_inline(str)) {
+        str->small.tag = CH_STR_INLINE_BIT | len;
+        str->small.buf[len] = 0;
+    } else {
+        str->len = len;
+        str->data[len] = 0;
+    }
+}
+
+void ch_str_heap(ch_string *str) {
+    size_t len = ch_str_len(str);
+    ch_str_reserve(str, ch_str_is_inline(str) ? CH_STR_INLINE + 1 : len,
+                   len + 1);
+}
+
+ch_string ch_str_copy(ch_string *str) {
+    if (ch_str_is_inline(str) || ch_str_is_static(str)) {
+        return *str;
+    }
+    if (!ch_str_is_shared(str)) {
+        ch_string shared = ch_str_new_len(str->data, str->len);
+        ch_str_delete(str);
+        *str = shared;
+        if (!ch_str_is_shared(str)) {
+            return *str;
+        }
+    }
+    ch_str_block_of(str)->refs++;
+    return *str;
+}
+
+void ch_str_push(ch_string *str, char c) {
+    size_t len = ch_str_len(str);
+    size_t size = ch_str_is_inline(str) ? CH_STR_INLINE + 1 : ch_str_cap(str);
+    char *data = ch_str_reserve(str, len + 1, 3 * size / 2 + 1);
+    data[len] = c;
+    ch_str_set_len(str, len + 1);
 }
 
 int decode_utf(ch_string const *str, size_t pos, size_t *bytes);
 
 int ch_str_pop(ch_string *str) {
-    if (!str || str->len == 0)
+    if (!str || ch_str_len(str) == 0)
         return -1;
 
-    size_t end = str->len;
+    char const *data = ch_str_data(str);
+    size_t end = ch_str_len(str);
     size_t i = end - 1;
 
-    while (i > 0 && ((unsigned char)str->data[i] & 0xC0) == 0x80)
+    while (i > 0 && ((unsigned char)data[i] & 0xC0) == 0x80)
         i--;
 
-    unsigned char lead = (unsigned char)str->data[i];
+    unsigned char lead = (unsigned char)data[i];
     size_t expected;
 
     if ((lead & 0x80) == 0x00)
@@ -68,7 +190,7 @@ int ch_str_pop(ch_string *str) {
         return -1;
 
     for (size_t j = i + 1; j < end; j++) {
-        if (((unsigned char)str->data[j] & 0xC0) != 0x80)
+        if (((unsigned char)data[j] & 0xC0) != 0x80)
             return -1;
     }
 
@@ -77,33 +199,35 @@ int ch_str_pop(ch_string *str) {
     if (bytes != expected)
         return -1;
 
-    str->len -= bytes;
-    str->data[str->len] = '\0';
+    ch_str_reserve(str, end, 0);
+    ch_str_set_len(str, end - bytes);
 
     return codepoint;
 }
 
 void ch_str_append(ch_string *str, ch_string *other) {
-    if (other->len == 0) {
+    size_t other_len = ch_str_len(other);
+    if (other_len == 0) {
         return;
     }
 
-    size_t needed = str->len + other->len + 1;
-
-    if (needed > str->size) {
-        size_t new_size = needed * 2;
-        char *new_data = realloc(str->data, new_size);
-        str->data = new_data;
-        str->size = new_size;
-    }
+    size_t len = ch_str_len(str);
+    size_t needed = len + other_len + 1;
 
-    memcpy(str->data + str->len, other->data, other->len);
-    str->len += other->len;
-    str->data[str->len] = '\0';
+    char *data = ch_str_reserve(str, len + other_len, needed * 2);
+    memcpy(data + len, ch_str_data(other), other_len);
+    ch_str_set_len(str, len + other_len);
 }
 
 void ch_str_delete(ch_string *str) {
-    free(str->data);
+    if (ch_str_is_shared(str)) {
+        ch_str_block *block = ch_str_block_of(str);
+        if (--block->refs == 0) {
+            free(block);
+        }
+    } else if (!ch_str_is_inline(str) && !ch_str_is_static(str)) {
+        free(str->data);
+    }
     str->data = NULL;
     str->len = 0;
     str->size = 0;
@@ -111,76 +235,73 @@ void ch_str_delete(ch_string *str) {
 
 void ch_str_replace(ch_string *str, size_t pos, size_t n,
                     ch_string const *rep) {
-    if (pos > str->len)
-        pos = str->len;
+    size_t len = ch_str_len(str);
+    size_t rep_len = ch_str_len(rep);
 
-    if (pos + n > str->len)
-        n = str->len - pos;
+    if (pos > len)
+        pos = len;
 
-    size_t new_len = str->len - n + rep->len;
+    if (pos + n > len)
+        n = len - pos;
 
-    if (new_len > str->size) {
-        str->size = new_len + 1;
-        str->data = realloc(str->data, str->size);
-    }
+    size_t new_len = len - n + rep_len;
+
+    char *data = ch_str_reserve(str, new_len, new_len + 1);
 
-    if (rep->len != n) {
-        memmove(str->data + pos + rep->len, str->data + pos + n,
-                str->len - (pos + n));
+    if (rep_len != n) {
+        memmove(data + pos + rep_len, data + pos + n, len - (pos + n));
     }
 
-    memcpy(str->data + pos, rep->data, rep->len);
+    memcpy(data + pos, ch_str_data(rep), rep_len);
 
-    str->len = new_len;
-    str->data[str->len] = '\0';
+    ch_str_set_len(str, new_len);
 }
 
 ch_string encode_utf8(int c) {
+    char buf[4];
     if (c <= 0x7F) {
-        ch_string out = ch_str_alloc(1);
-        ch_str_push(&out, c);
-        return out;
+        buf[0] = c;
+        return ch_str_new_len(buf, 1);
     } else if (c <= 0x7FF) {
-        ch_string out = ch_str_alloc(1);
-        ch_str_push(&out, (char)(0xC0 | (c >> 6)));
-        ch_str_push(&out, (char)(0x80 | (c & 0x3F)));
-        return out;
+        buf[0] = (char)(0xC0 | (c >> 6));
+        buf[1] = (char)(0x80 | (c & 0x3F));
+        return ch_str_new_len(buf, 2);
     } else if (c <= 0xFFFF) {
-        ch_string out = ch_str_alloc(1);
-        ch_str_push(&out, (char)(0xE0 | (c >> 12)));
-        ch_str_push(&out, (char)(0x80 | ((c >> 6) & 0x3F)));
-        ch_str_push(&out, (char)(0x80 | (c & 0x3F)));
-        return out;
+        buf[0] = (char)(0xE0 | (c >> 12));
+        buf[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+        buf[2] = (char)(0x80 | (c & 0x3F));
+        return ch_str_new_len(buf, 3);
     } else {
-        ch_string out = ch_str_alloc(1);
-        ch_str_push(&out, (char)(0xF0 | (c >> 18)));
-        ch_str_push(&out, (char)(0x80 | ((c >> 12) & 0x3F)));
-        ch_str_push(&out, (char)(0x80 | ((c >> 6) & 0x3F)));
-        ch_str_push(&out, (char)(0x80 | (c & 0x3F)));
-        return out;
+        buf[0] = (char)(0xF0 | (c >> 18));
+        buf[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+        buf[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+        buf[3] = (char)(0x80 | (c & 0x3F));
+        return ch_str_new_len(buf, 4);
     }
 }
 
 int decode_utf(ch_string const *str, size_t pos, size_t *bytes) {
     *bytes = 0;
-    if (pos >= str->len)
+    char const *data = ch_str_data(str);
+    size_t len = ch_str_len(str);
+    if (pos >= len)
         return 0;
-    unsigned char c = str->data[pos];
+    unsigned char c = data[pos];
 
     if (c < 0x80) {
         *bytes = 1;
         return c;
-    } else if ((c >> 5) == 0b110 && pos + 1 < str->len) {
+    } else if ((c >> 5) == 0b110 && pos + 1 < len) {
         *bytes = 2;
-        return ((c & 31) << 6) | (str->data[pos + 1] & 63);
-    } else if ((c >> 4) == 0b1110 && pos + 2 < str->len) {
+        return ((c & 31) << 6) | (data[pos + 1] & 63);
+    } else if ((c >> 4) == 0b1110 && pos + 2 < len) {
         *bytes = 3;
-        return ((c & 15) << 12) | ((str->data[pos + 1] & 63) << 6) |
-               (str->data[pos + 2] & 63);
-    } else if ((c >> 3) == 0b11110 && pos + 3 < str->len) {
+        return ((c & 15) << 12) | ((data[pos + 1] & 63) << 6) |
+               (data[pos + 2] & 63);
+    } else if ((c >> 3) == 0b11110 && pos + 3 < len) {
         *bytes = 4;
-        return ((c & 7) << 18) | ((str->data[pos + 1] & 63) << 12) |
-               ((str->data[pos + 2] & 63) << 6) | (str->data[pos + 3] & 63);
+        return ((c & 7) << 18) | ((data[pos + 1] & 63) << 12) |
+               ((data[pos + 2] & 63) << 6) | (data[pos + 3] & 63);
     }
 
     *bytes = 0;
@@ -192,7 +313,8 @@ ssize_t utf8_nth_index(ch_string const *str, size_t n) {
     size_t i = 0;
     size_t bytes;
 
-    while (pos < str->len) {
+    size_t len = ch_str_len(str);
+    while (pos < len) {
         decode_utf(str, pos, &bytes);
         if (bytes == 0)
             return -1;
@@ -218,38 +340,16 @@ ssize_t utf8_nth_char(ch_string const *str, size_t n) {
     return ch;
 }
 
-ch_value ch_valof_int(int n) {
-    return (ch_value){.kind = CH_VALK_INT, .value.i = n};
-}
-
-ch_value ch_valof_float(float n) {
-    return (ch_value){.kind = CH_VALK_FLOAT, .value.f = n};
-}
-
-// UTF32 codepoint
-ch_value ch_valof_char(int n) {
-    return (ch_value){.kind = CH_VALK_CHAR, .value.i = n};
-}
+// Out of line string payloads of values
+static _Thread_local ch_slab ch_str_slab = {.size = sizeof(ch_string)};
 
+// Payloads are either a slab cell owned by the value or a literal, which
+// only `ch_valof_literal` makes. A static string moved in is copied so
+// the two never mix
 ch_value ch_valof_string(ch_string n) {
-    return (ch_value){.kind = CH_VALK_STRING, .value.s = n};
-}
-
-ch_value ch_valof_bool(char n) {
-    return (ch_value){.kind = CH_VALK_BOOL, .value.b = n};
-}
-
-ch_value ch_valof_stack(struct ch_stack_node *n) {
-    return (ch_value){.kind = CH_VALK_STACK, .value.stk = n};
-}
-
-ch_value ch_valof_opaque(void *ptr) {
-    return (ch_value){.kind = CH_VALK_OPAQUE, .value.op = ptr};
-}
-
-ch_value
-ch_valof_function(struct ch_stack_node *(*fn)(struct ch_stack_node **)) {
-    return (ch_value){.kind = CH_VALK_FUNCTION, .value.fn = fn};
+    ch_string *s = ch_slab_alloc(&ch_str_slab);
+    *s = ch_str_is_static(&n) ? ch_str_new_len(n.data, n.len) : n;
+    return (ch_value){.kind = CH_VALK_STRING, .value.s = s};
 }
 
 const char *ch_valk_name(ch_value_kind k) {
@@ -277,17 +377,37 @@ const char *ch_valk_name(ch_value_kind k) {
     return ch_type_table[k - CH_VALUE_KINDS].name;
 }
 
-char ch_valas_bool(ch_value v) {
-    if (v.kind != CH_VALK_BOOL) {
-        printf("ERR: Expected 'bool', got '%s'\n", ch_valk_name(v.kind));
-        exit(1);
+void ch_val_expected(ch_value_kind want, ch_value_kind got) {
+    printf("ERR: Expected '%s', got '%s'\n", ch_valk_name(want),
+           ch_valk_name(got));
+    exit(1);
+}
+
+ch_string ch_valas_string(ch_value v) {
+    if (v.kind != CH_VALK_STRING) {
+        ch_val_expected(CH_VALK_STRING, v.kind);
+    }
+    ch_string s = *v.value.s;
+    if (!ch_str_is_static(v.value.s)) {
+        ch_slab_free(&ch_str_slab, v.value.s);
+    }
+    return s;
+}
+
+void ch_val_own_string(ch_value *val) {
+    if (ch_str_is_static(val->value.s)) {
+        ch_string *lit = val->value.s;
+        val->value.s = ch_slab_alloc(&ch_str_slab);
+        *val->value.s = ch_str_new_len(lit->data, lit->len);
     }
-    return v.value.b;
 }
 
-void ch_val_delete(ch_value *val) {
+void ch_val_delete_boxed(ch_value *val) {
     if (val->kind == CH_VALK_STRING) {
-        ch_str_delete(&val->value.s);
+        if (!ch_str_is_static(val->value.s)) {
+            ch_str_delete(val->value.s);
+            ch_slab_free(&ch_str_slab, val->value.s);
+        }
     } else if (val->kind == CH_VALK_STACK) {
         ch_stk_delete(&val->value.stk);
     } else if (val->kind >= CH_VALUE_KINDS) {
@@ -298,29 +418,267 @@ void ch_val_delete(ch_value *val) {
     val->kind = -1;
 }
 
-ch_stack_node *ch_stk_copy(ch_stack_node *stk) {
-    ch_stack_node *out = NULL;
-    ch_stack_node **tail = &out;
+typedef struct ch_slab_chunk {
+    struct ch_slab_chunk *next;
+    max_align_t data[];
+} ch_slab_chunk;
 
-    while (stk) {
-        ch_stack_node *node = malloc(sizeof(ch_stack_node));
-        node->val = ch_valcpy(&stk->val);
-        node->next = NULL;
+void *ch_slab_alloc(ch_slab *slab) {
+    if (slab->free) {
+        void *ptr = slab->free;
+        slab->free = *(void **)ptr;
+        slab->recycled++;
+        return ptr;
+    }
 
-        *tail = node;
-        tail = &node->next;
+    if (slab->bump == slab->end) {
+        ch_slab_chunk *chunk =
+            malloc(sizeof(ch_slab_chunk) + slab->size * CH_SLAB_LEN);
+        if (chunk == NULL) {
+            printf("ERR: Out of memory\n");
+            exit(1);
+        }
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->bump = (char *)chunk->data;
+        slab->end = slab->bump + slab->size * CH_SLAB_LEN;
+    }
+
+    void *ptr = slab->bump;
+    slab->bump += slab->size;
+    slab->fresh++;
+    return ptr;
+}
+
+void ch_slab_free(ch_slab *slab, void *ptr) {
+    *(void **)ptr = slab->free;
+    slab->free = ptr;
+}
 
-        stk = stk->next;
+static _Thread_local ch_slab ch_deque_slabs[CH_DEQUE_CLASSES] = {
+    {.size = sizeof(ch_deque) + sizeof(ch_value) * CH_DEQUE_SMALL},
+    {.size = sizeof(ch_deque) + sizeof(ch_value) * CH_DEQUE_SMALL * 2},
+    {.size = sizeof(ch_deque) + sizeof(ch_value) * CH_DEQUE_SMALL * 4},
+};
+
+ch_slab const *ch_stk_slabs() { return ch_deque_slabs; }
+
+// Bytes taken by `cap` elements in `layout`
+static size_t ch_deque_bytes(ch_deque_layout layout, size_t cap) {
+    switch (layout) {
+    case CH_DEQUE_BOXED:
+        return sizeof(ch_value) * cap;
+    case CH_DEQUE_BOOL:
+        return (cap + 7) / 8;
+    default:
+        return sizeof(int32_t) * cap;
     }
+}
 
-    return out;
+static ch_deque_layout ch_deque_layout_of(ch_value_kind kind) {
+    switch (kind) {
+    case CH_VALK_INT:
+        return CH_DEQUE_INT;
+    case CH_VALK_FLOAT:
+        return CH_DEQUE_FLOAT;
+    case CH_VALK_CHAR:
+        return CH_DEQUE_CHAR;
+    case CH_VALK_BOOL:
+        return CH_DEQUE_BOOL;
+    default:
+        return CH_DEQUE_BOXED;
+    }
+}
+
+// Slab serving `bytes` of elements, `CH_DEQUE_CLASSES` if it is left to malloc
+static size_t ch_deque_class(size_t bytes) {
+    size_t k = 0;
+    while (k < CH_DEQUE_CLASSES &&
+           ch_deque_slabs[k].size - sizeof(ch_deque) < bytes) {
+        ++k;
+    }
+    return k;
+}
+
+// Empty deque with room for at least `cap` elements, packed layouts take
+// as many elements as their slab has room for
+static ch_deque *ch_deque_alloc(ch_deque_layout layout, size_t cap) {
+    size_t size = CH_DEQUE_SMALL;
+    while (size < cap) {
+        size *= 2;
+    }
+
+    ch_deque *deque;
+    size_t k = ch_deque_class(ch_deque_bytes(layout, size));
+    if (k < CH_DEQUE_CLASSES) {
+        size_t room = ch_deque_slabs[k].size - sizeof(ch_deque);
+        while (ch_deque_bytes(layout, size * 2) <= room) {
+            size *= 2;
+        }
+        deque = ch_slab_alloc(&ch_deque_slabs[k]);
+    } else {
+        deque = malloc(sizeof(ch_deque) + ch_deque_bytes(layout, size));
+        if (deque == NULL) {
+            printf("ERR: Out of memory\n");
+            exit(1);
+        }
+    }
+    deque->refs = 1;
+    deque->head = 0;
+    deque->len = 0;
+    deque->cap = size;
+    deque->layout = layout;
+    return deque;
+}
+
+// Releases the buffer alone, its values must have been moved out
+static void ch_deque_free(ch_deque *deque) {
+    size_t k = ch_deque_class(ch_deque_bytes(deque->layout, deque->cap));
+    if (k < CH_DEQUE_CLASSES) {
+        ch_slab_free(&ch_deque_slabs[k], deque);
+    } else {
+        free(deque);
+    }
+}
+
+static size_t ch_deque_slot(ch_deque const *deque, size_t i) {
+    return (deque->head + i) & (deque->cap - 1);
+}
+
+ch_value ch_stk_get(ch_deque const *stk, size_t i) {
+    size_t k = ch_deque_slot(stk, i);
+    switch (stk->layout) {
+    case CH_DEQUE_INT:
+        return ch_valof_int(((int32_t const *)stk->data)[k]);
+    case CH_DEQUE_FLOAT:
+        return ch_valof_float(((float const *)stk->data)[k]);
+    case CH_DEQUE_CHAR:
+        return ch_valof_char(((int32_t const *)stk->data)[k]);
+    case CH_DEQUE_BOOL:
+        return ch_valof_bool((((uint8_t const *)stk->data)[k / 8] >> k % 8) &
+                             1);
+    default:
+        return stk->data[k];
+    }
+}
+
+// Stores `val` as element `i`, its kind must fit the layout of `deque`
+static void ch_deque_set(ch_deque *deque, size_t i, ch_value val) {
+    size_t k = ch_deque_slot(deque, i);
+    switch (deque->layout) {
+    case CH_DEQUE_INT:
+    case CH_DEQUE_CHAR:
+        ((int32_t *)deque->data)[k] = val.value.i;
+        break;
+    case CH_DEQUE_FLOAT:
+        ((float *)deque->data)[k] = val.value.f;
+        break;
+    case CH_DEQUE_BOOL: {
+        uint8_t *bits = (uint8_t *)deque->data;
+        if (val.value.b) {
+            bits[k / 8] |= 1 << k % 8;
+        } else {
+            bits[k / 8] &= ~(1 << k % 8);
+        }
+        break;
+    }
+    default:
+        deque->data[k] = val;
+        break;
+    }
+}
+
+// Element `i` for a new owner, copied out of a `shared` boxed deque
+static ch_value ch_deque_take(ch_deque const *deque, size_t i, char shared) {
+    if (shared && deque->layout == CH_DEQUE_BOXED) {
+        return ch_valcpy(ch_stk_at(deque, i));
+    }
+    return ch_stk_get(deque, i);
+}
+
+// Drops the reference `old` had to its buffer after its values were taken
+static void ch_deque_release(ch_deque *old, char shared) {
+    if (shared) {
+        old->refs--;
+    } else {
+        ch_deque_free(old);
+    }
+}
+
+// Makes `*stk` exclusive in `layout`, with room for `extra` more elements
+static void ch_deque_relayout(ch_deque **stk, ch_deque_layout layout,
+                              size_t extra) {
+    ch_deque *old = *stk;
+    size_t len = ch_stk_len(old);
+    if (old && old->refs == 1 && old->layout == layout &&
+        len + extra <= old->cap) {
+        return;
+    }
+
+    size_t cap = old ? old->cap : CH_DEQUE_SMALL;
+    while (cap < len + extra) {
+        cap *= 2;
+    }
+    ch_deque *new = ch_deque_alloc(layout, cap);
+    new->len = len;
+
+    if (old) {
+        char shared = old->refs > 1;
+        for (size_t i = 0; i < len; ++i) {
+            ch_deque_set(new, i, ch_deque_take(old, i, shared));
+        }
+        ch_deque_release(old, shared);
+    }
+    *stk = new;
+}
+
+// Makes `*stk` exclusive, with room for `extra` more elements
+static void ch_deque_reserve(ch_deque **stk, size_t extra) {
+    ch_deque_layout layout = *stk ? (*stk)->layout : CH_DEQUE_BOXED;
+    ch_deque_relayout(stk, layout, extra);
+}
+
+// Makes room for `val`, unpacking `*stk` if `val` does not fit its layout
+static void ch_deque_reserve_for(ch_deque **stk, ch_value const *val) {
+    ch_deque *deque = *stk;
+    if (deque && deque->layout != CH_DEQUE_BOXED &&
+        deque->layout != ch_deque_layout_of(val->kind)) {
+        ch_deque_relayout(stk, CH_DEQUE_BOXED, 1);
+    } else {
+        ch_deque_reserve(stk, 1);
+    }
+}
+
+void ch_stk_unpack(ch_deque **stk) {
+    if (*stk && (*stk)->layout != CH_DEQUE_BOXED) {
+        ch_deque_relayout(stk, CH_DEQUE_BOXED, 0);
+    }
+}
+
+ch_deque *ch_stk_copy(ch_deque *stk) {
+    if (stk) {
+        stk->refs++;
+    }
+    return stk;
+}
+
+void ch_stk_own(ch_deque **stk) {
+    if (*stk && (*stk)->refs > 1) {
+        ch_deque_reserve(stk, 0);
+    }
 }
 
-ch_value ch_valcpy(ch_value const *v) {
+ch_value ch_valcpy_boxed(ch_value const *v) {
     ch_value other;
     other.kind = v->kind;
     if (v->kind == CH_VALK_STRING) {
-        other.value.s = ch_str_new(v->value.s.data);
+        if (ch_str_is_static(v->value.s)) {
+            other.value.s = v->value.s;
+        } else {
+            // Only the representation of `v` changes, never its contents
+            other.value.s = ch_slab_alloc(&ch_str_slab);
+            *other.value.s = ch_str_copy(v->value.s);
+        }
     } else if (v->kind == CH_VALK_STACK) {
         other.value.stk = ch_stk_copy(v->value.stk);
     } else if (v->kind == CH_VALK_OPAQUE) {
@@ -335,83 +693,220 @@ ch_value ch_valcpy(ch_value const *v) {
     return other;
 }
 
-ch_stack_node *ch_stk_new() { return NULL; }
+ch_deque *ch_stk_new() { return NULL; }
 
-void ch_stk_push(ch_stack_node **stk, ch_value val) {
-    ch_stack_node *new = malloc(sizeof(ch_stack_node));
-    new->val = val;
-    new->next = *stk;
-    *stk = new;
+void ch_stk_push(ch_deque **stk, ch_value val) {
+    ch_deque_reserve_for(stk, &val);
+    ch_deque *deque = *stk;
+    deque->head = (deque->head - 1) & (deque->cap - 1);
+    deque->len++;
+    ch_deque_set(deque, 0, val);
 }
 
-ch_value ch_stk_pop(ch_stack_node **stk) {
-    ch_value v = (*stk)->val;
-    ch_stack_node *next = (*stk)->next;
-    free(*stk);
-    *stk = next;
-    return v;
+ch_value ch_stk_pop(ch_deque **stk) {
+    ch_stk_own(stk);
+    ch_deque *deque = *stk;
+    ch_value val = ch_stk_get(deque, 0);
+    deque->head = (deque->head + 1) & (deque->cap - 1);
+    deque->len--;
+    return val;
 }
 
-ch_stack_node *ch_stk_args(ch_stack_node **from, size_t n, char is_rest) {
-    ch_stack_node *args = NULL;
-    if (n != 0) {
+void ch_stk_push_back(ch_deque **stk, ch_value val) {
+    ch_deque_reserve_for(stk, &val);
+    ch_deque *deque = *stk;
+    ch_deque_set(deque, deque->len++, val);
+}
 
-        if (*from == NULL) {
-            printf("ERR: Tried to pop '%zu' arguments, but stack is empty.\n",
-                   n);
-            exit(1);
+ch_value ch_stk_pop_back(ch_deque **stk) {
+    ch_stk_own(stk);
+    ch_deque *deque = *stk;
+    return ch_stk_get(deque, --deque->len);
+}
+
+///! MOVES
+void ch_stk_append(ch_deque **to, ch_deque *from) {
+    size_t len = ch_stk_len(from);
+    if (len == 0) {
+        ch_stk_delete(&from);
+        return;
+    }
+    if (*to == NULL) {
+        *to = from;
+        return;
+    }
+    if ((*to)->layout != from->layout) {
+        ch_stk_unpack(to);
+        ch_stk_unpack(&from);
+    }
+
+    // Move the shorter side into the other when `from` can be reused
+    if (from->refs == 1 && (*to)->len < len) {
+        ch_deque *bottom = *to;
+        *to = from;
+        ch_deque_reserve(to, bottom->len);
+        char shared = bottom->refs > 1;
+        for (size_t i = 0; i < bottom->len; ++i) {
+            ch_stk_push_back(to, ch_deque_take(bottom, i, shared));
         }
+        ch_deque_release(bottom, shared);
+        return;
+    }
 
-        args = *from;
-        ch_stack_node *curr = *from;
+    ch_deque_reserve(to, len);
+    char shared = from->refs > 1;
+    for (size_t i = len; i > 0; --i) {
+        ch_stk_push(to, ch_deque_take(from, i - 1, shared));
+    }
+    ch_deque_release(from, shared);
+}
 
-        for (size_t i = 1; i < n; ++i) {
-            curr = curr->next;
-            if (curr == NULL) {
-                printf("ERR: Tried to pop '%zu' arguments, but stack is too "
-                       "short.\n",
-                       n);
-                exit(1);
+void ch_stk_delete(ch_deque **stk) {
+    ch_deque *deque = *stk;
+    if (deque && --deque->refs == 0) {
+        if (deque->layout == CH_DEQUE_BOXED) {
+            for (size_t i = 0; i < deque->len; ++i) {
+                ch_val_delete(ch_stk_at(deque, i));
             }
         }
+        ch_deque_free(deque);
+    }
+    *stk = NULL;
+}
+
+ch_stack ch_stack_new() {
+    return (ch_stack){
+        .data = NULL, .len = 0, .size = 0, .base = 0, .next = NULL};
+}
 
-        *from = curr->next;
-        curr->next = NULL;
+void ch_stack_reserve(ch_stack *stk, size_t extra) {
+    if (stk->len + extra > stk->size) {
+        size_t size = 3 * stk->size / 2 + 8;
+        if (size < stk->len + extra)
+            size = stk->len + extra;
+        stk->data = realloc(stk->data, size * sizeof(ch_value));
+        stk->size = size;
     }
+}
 
+void ch_stack_underflow(ch_stack *stk, size_t n) {
+    if (stk->len == stk->base) {
+        printf("ERR: Tried to pop '%zu' arguments, but stack is empty.\n", n);
+    } else {
+        printf("ERR: Tried to pop '%zu' arguments, but stack is too "
+               "short.\n",
+               n);
+    }
+    exit(1);
+}
+
+// Boxes the frame below the top `n` values into one value beneath them
+static void ch_stack_box_rest(ch_stack *stk, size_t n) {
+    ch_stack_reserve(stk, 1);
+    size_t top = stk->len - n;
+    stk->len = top;
+    ch_value rest = ch_valof_stack(ch_stack_to_deque(stk));
+    memmove(stk->data + stk->len + 1, stk->data + top, n * sizeof(ch_value));
+    stk->data[stk->len] = rest;
+    stk->len += 1 + n;
+}
+
+size_t ch_stack_enter(ch_stack *stk, size_t n, char is_rest) {
+    ch_stack_need(stk, n);
+    size_t base = stk->base;
     if (is_rest) {
-        ch_stack_node *arg_ext = ch_stk_new();
-        ch_stk_push(&arg_ext,
-                    (ch_value){.kind = CH_VALK_STACK, .value.stk = *from});
-        ch_stk_append(&arg_ext, args);
-        *from = NULL;
-        args = arg_ext;
+        ch_stack_box_rest(stk, n);
+    } else {
+        stk->base = stk->len - n;
     }
+    return base;
+}
 
+void ch_stack_leave(ch_stack *stk, size_t base, size_t n, char is_rest) {
+    ch_stack_need(stk, n);
+    if (is_rest) {
+        ch_stack_box_rest(stk, n);
+    } else {
+        size_t top = stk->len - n;
+        if (top != stk->base) {
+            for (size_t i = stk->base; i < top; ++i) {
+                ch_val_delete(&stk->data[i]);
+            }
+            memmove(stk->data + stk->base, stk->data + top,
+                    n * sizeof(ch_value));
+            stk->len = stk->base + n;
+        }
+    }
+    stk->base = base;
+}
+
+///! MOVES
+ch_deque *ch_stack_pop_args(ch_stack *stk, size_t n, char is_rest) {
+    size_t base = ch_stack_enter(stk, n, is_rest);
+    ch_deque *args = ch_stack_to_deque(stk);
+    stk->base = base;
     return args;
 }
 
 ///! MOVES
-void ch_stk_append(ch_stack_node **to, ch_stack_node *from) {
-    if (from) {
-        ch_stack_node *end = from;
-        while (end->next != NULL) {
-            end = end->next;
+ch_deque *ch_stack_to_deque(ch_stack *stk) {
+    size_t len = stk->len - stk->base;
+    if (len == 0) {
+        return NULL;
+    }
+    ch_deque *deque = ch_deque_alloc(CH_DEQUE_BOXED, len);
+    for (size_t i = 0; i < len; ++i) {
+        deque->data[i] = stk->data[stk->len - 1 - i];
+    }
+    deque->len = len;
+    stk->len = stk->base;
+    return deque;
+}
+
+///! MOVES
+ch_deque *ch_stack_to_deque_as(ch_stack *stk, ch_value_kind kind) {
+    size_t len = stk->len - stk->base;
+    ch_deque_layout layout = ch_deque_layout_of(kind);
+    for (size_t i = stk->base; i < stk->len; ++i) {
+        if (stk->data[i].kind != kind) {
+            layout = CH_DEQUE_BOXED;
+            break;
         }
-        end->next = *to;
-        *to = from;
     }
+    if (len == 0 || layout == CH_DEQUE_BOXED) {
+        return ch_stack_to_deque(stk);
+    }
+
+    ch_deque *deque = ch_deque_alloc(layout, len);
+    deque->len = len;
+    for (size_t i = 0; i < len; ++i) {
+        ch_deque_set(deque, i, stk->data[stk->len - 1 - i]);
+    }
+    stk->len = stk->base;
+    return deque;
 }
 
-void ch_stk_delete(ch_stack_node **stk) {
-    ch_stack_node *head = *stk;
-    while (head) {
-        ch_val_delete(&head->val);
-        ch_stack_node *next = head->next;
-        free(head);
-        head = next;
+///! MOVES
+void ch_stack_from_deque(ch_stack *stk, ch_deque *deque) {
+    size_t n = ch_stk_len(deque);
+    if (n == 0) {
+        ch_stk_delete(&deque);
+        return;
     }
-    *stk = NULL;
+    ch_stack_reserve(stk, n);
+    char shared = deque->refs > 1;
+    for (size_t i = n; i > 0; --i) {
+        stk->data[stk->len++] = ch_deque_take(deque, i - 1, shared);
+    }
+    ch_deque_release(deque, shared);
+}
+
+void ch_stack_delete(ch_stack *stk) {
+    for (size_t i = 0; i < stk->len; ++i) {
+        ch_val_delete(&stk->data[i]);
+    }
+    free(stk->data);
+    *stk = ch_stack_new();
 }
 
 ch_string ch_str_from_int(int v) {
@@ -462,26 +957,25 @@ ch_string print_value_str(ch_value v) {
     }
 
     case CH_VALK_STRING:
-        ch_str_append(&out, &v.value.s);
+        ch_str_append(&out, v.value.s);
         break;
 
     case CH_VALK_STACK: {
-        ch_stack_node *n = v.value.stk;
+        ch_deque *stk = v.value.stk;
+        size_t len = ch_stk_len(stk);
 
         ch_str_push(&out, '[');
 
-        while (n) {
-            ch_string elem = print_value_str(n->val);
+        for (size_t i = 0; i < len; ++i) {
+            ch_string elem = print_value_str(ch_stk_get(stk, i));
             ch_str_append(&out, &elem);
             ch_str_delete(&elem);
 
-            if (n->next) {
+            if (i + 1 < len) {
                 ch_string comma = ch_str_new(", ");
                 ch_str_append(&out, &comma);
                 ch_str_delete(&comma);
             }
-
-            n = n->next;
         }
 
         ch_str_push(&out, ']');
@@ -516,7 +1010,7 @@ ch_string print_value_str(ch_value v) {
 
 void print_value(ch_value v) {
     ch_string s = print_value_str(v);
-    printf("%s", s.data);
+    printf("%s", ch_str_data(&s));
     ch_str_delete(&s);
 }
 
@@ -525,92 +1019,19 @@ void println_value(ch_value v) {
     printf("\n");
 }
 
-ch_stack_node *_mangle_(print, "print")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    ch_value v = ch_stk_pop(&local);
+void _mangle_(print, "print")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value v = ch_stack_pop(full);
     println_value(v);
     ch_val_delete(&v);
-    return NULL;
-}
-
-ch_stack_node *_mangle_(dup, "dup")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    ch_value v = ch_stk_pop(&local);
-    ch_value cp = ch_valcpy(&v);
-    ch_stk_push(&local, v);
-    ch_stk_push(&local, cp);
-    return local;
-}
-
-ch_stack_node *_mangle_(swp, "swp")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value a = ch_stk_pop(&local);
-    ch_value b = ch_stk_pop(&local);
-    ch_stk_push(&local, a);
-    ch_stk_push(&local, b);
-    return local;
-}
-
-ch_stack_node *_mangle_(over, "ovr")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value a = ch_stk_pop(&local);
-    ch_value b = ch_stk_pop(&local);
-    ch_value b2 = ch_valcpy(&b);
-    ch_stk_push(&local, b);
-    ch_stk_push(&local, a);
-    ch_stk_push(&local, b2);
-    return local;
-}
-
-ch_stack_node *_mangle_(pick, "pck")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 3, 0);
-    ch_value val = ch_valcpy(&local->next->next->val);
-    ch_stk_push(&local, val);
-    return local;
-}
-
-ch_stack_node *_mangle_(nip, "nip")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value a = ch_stk_pop(&local);
-    ch_value b = ch_stk_pop(&local);
-    ch_stk_push(&local, a);
-    ch_val_delete(&b);
-    return local;
-}
-
-ch_stack_node *_mangle_(swpd, "swpd")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 3, 0);
-    ch_value a = ch_stk_pop(&local);
-    ch_value b = ch_stk_pop(&local);
-    ch_value c = ch_stk_pop(&local);
-    ch_stk_push(&local, b);
-    ch_stk_push(&local, c);
-    ch_stk_push(&local, a);
-    return local;
-}
-
-ch_stack_node *_mangle_(tck, "tck")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value a = ch_stk_pop(&local);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a2 = ch_valcpy(&a);
-    ch_stk_push(&local, a2);
-    ch_stk_push(&local, b);
-    ch_stk_push(&local, a);
-    return local;
 }
 
-ch_stack_node *_mangle_(dbg, "dbg")(ch_stack_node **full) {
-    ch_stack_node *elem = *full;
-    size_t i = 0;
+void _mangle_(dbg, "dbg")(ch_stack *full) {
     printf("DEBUG:\n");
-    while (elem) {
+    for (size_t i = 0; i < full->len - full->base; ++i) {
         printf("%zu | ", i);
-        println_value(elem->val);
-        elem = elem->next;
-        ++i;
+        println_value(*ch_stack_peek(full, i));
     }
-    return NULL;
 }
 
 char val_equals(ch_value const *v1, ch_value const *v2) {
@@ -627,21 +1048,25 @@ char val_equals(ch_value const *v1, ch_value const *v2) {
     case CH_VALK_CHAR:
         return v1->value.i == v2->value.i;
     case CH_VALK_STRING:
-        return strcmp(v1->value.s.data, v2->value.s.data) == 0;
+        return strcmp(ch_str_data(v1->value.s),
+                      ch_str_data(v2->value.s)) == 0;
     case CH_VALK_FUNCTION:
         return 0;
     case CH_VALK_OPAQUE:
         return 0;
     case CH_VALK_STACK: {
-        ch_stack_node *s1 = v1->value.stk;
-        ch_stack_node *s2 = v2->value.stk;
-        while (s1 != NULL && s2 != NULL) {
-            if (!val_equals(&s1->val, &s2->val))
+        ch_deque *s1 = v1->value.stk;
+        ch_deque *s2 = v2->value.stk;
+        size_t len = ch_stk_len(s1);
+        if (len != ch_stk_len(s2))
+            return 0;
+        for (size_t i = 0; i < len; ++i) {
+            ch_value e1 = ch_stk_get(s1, i);
+            ch_value e2 = ch_stk_get(s2, i);
+            if (!val_equals(&e1, &e2))
                 return 0;
-            s1 = s1->next;
-            s2 = s2->next;
         }
-        return s1 == NULL && s2 == NULL;
+        return 1;
     }
     default:
         break;
@@ -650,191 +1075,142 @@ char val_equals(ch_value const *v1, ch_value const *v2) {
     return 0; // TODO: User types
 }
 
-ch_stack_node *_mangle_(equ_cmp, "=")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_eq_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
 
-    ch_stk_push(&local, ch_valof_bool(val_equals(&a, &b)));
+    ch_stack_push(full, ch_valof_bool(val_equals(&a, &b)));
     ch_val_delete(&a);
     ch_val_delete(&b);
-    return local;
 }
 
-ch_stack_node *_mangle_(sub, "-")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_sub_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     if (a.kind == CH_VALK_INT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_int(a.value.i - b.value.i));
+        ch_stack_push(full, ch_valof_int(a.value.i - b.value.i));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_float(a.value.f - b.value.i));
+        ch_stack_push(full, ch_valof_float(a.value.f - b.value.i));
     } else if (a.kind == CH_VALK_INT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(a.value.i - b.value.f));
+        ch_stack_push(full, ch_valof_float(a.value.i - b.value.f));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(a.value.f - b.value.f));
+        ch_stack_push(full, ch_valof_float(a.value.f - b.value.f));
     } else {
         printf("ERR: '-' expected two numbers, got '%s' and '%s'\n",
                ch_valk_name(a.kind), ch_valk_name(b.kind));
         exit(1);
     }
-    return local;
 }
 
-ch_stack_node *_mangle_(add, "+")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_add_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     if (a.kind == CH_VALK_INT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_int(a.value.i + b.value.i));
+        ch_stack_push(full, ch_valof_int(a.value.i + b.value.i));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_float(a.value.f + b.value.i));
+        ch_stack_push(full, ch_valof_float(a.value.f + b.value.i));
     } else if (a.kind == CH_VALK_INT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(a.value.i + b.value.f));
+        ch_stack_push(full, ch_valof_float(a.value.i + b.value.f));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(a.value.f + b.value.f));
+        ch_stack_push(full, ch_valof_float(a.value.f + b.value.f));
     } else {
         printf("ERR: '+' expected two numbers, got '%s' and '%s'\n",
                ch_valk_name(a.kind), ch_valk_name(b.kind));
         exit(1);
     }
-    return local;
 }
 
-ch_stack_node *_mangle_(boxstk, "box")(ch_stack_node **full) {
-    ch_value val;
-    val.kind = CH_VALK_STACK;
-    val.value.stk = *full;
-    ch_stack_node *stk = ch_stk_new();
-    ch_stk_push(&stk, val);
-    *full = NULL;
-    return stk;
+void _mangle_(boxstk, "box")(ch_stack *full) {
+    ch_deque *frame = ch_stack_to_deque(full);
+    ch_stack_push(full, ch_valof_stack(frame));
+}
+
+void ch_boxstk_as(ch_stack *full, ch_value_kind kind) {
+    ch_deque *frame = ch_stack_to_deque_as(full, kind);
+    ch_stack_push(full, ch_valof_stack(frame));
 }
 
-ch_stack_node *_mangle_(flat, "flat")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    ch_value stk = ch_stk_pop(&local);
+void _mangle_(flat, "flat")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value stk = ch_stack_pop(full);
     if (stk.kind != CH_VALK_STACK) {
         printf("ERR: '⬚' expected 'stack', got '%s'\n", ch_valk_name(stk.kind));
     }
-    ch_stk_append(full, stk.value.stk);
-    return NULL;
+    ch_stack_from_deque(full, stk.value.stk);
 }
 
-ch_stack_node *_mangle_(pop, "pop")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    ch_value val = ch_stk_pop(&local);
-    ch_val_delete(&val);
-    return local;
-}
-
-ch_stack_node *_mangle_(fst_pop, "fst!")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_STACK) {
+void _mangle_(fst_pop, "fst!")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STACK) {
         printf("ERR: '⊢!' expected stack, got '%s'\n",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    if (local->val.value.stk == NULL) {
+    if (ch_stk_len(top->value.stk) == 0) {
         printf("ERR: '⊢!' got empty stack");
         exit(1);
     }
-    ch_value val = ch_stk_pop(&local->val.value.stk);
-    ch_stk_push(&local, val);
-    return local;
+    ch_value val = ch_stk_pop(&top->value.stk);
+    ch_stack_push(full, val);
 }
 
-ch_stack_node *_mangle_(fst, "fst")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_STACK) {
+void _mangle_(fst, "fst")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STACK) {
         printf("ERR: '⊢' expected stack, got '%s'\n",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    if (local->val.value.stk == NULL) {
+    if (ch_stk_len(top->value.stk) == 0) {
         printf("ERR: '⊢' got empty stack");
         exit(1);
     }
-    ch_value top = ch_valcpy(&local->val.value.stk->val);
-    ch_stk_push(&local, top);
-    return local;
+    ch_value val = ch_deque_take(top->value.stk, 0, 1);
+    ch_stack_push(full, val);
 }
 
-ch_stack_node *_mangle_(lst_pop, "lst!")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_STACK) {
+void _mangle_(lst_pop, "lst!")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STACK) {
         printf("ERR: '⊣!' expected stack, got '%s'\n",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    if (local->val.value.stk == NULL) {
+    if (ch_stk_len(top->value.stk) == 0) {
         printf("ERR: '⊣!' got empty stack");
         exit(1);
     }
-    ch_stack_node **stk = &local->val.value.stk;
-
-    if (*stk == NULL) {
-        printf("ERR: '⊣!' got empty stack");
-        exit(1);
-    }
-
-    ch_stack_node *cur = *stk;
-    ch_stack_node *prev = NULL;
-
-    while (cur->next != NULL) {
-        prev = cur;
-        cur = cur->next;
-    }
-
-    if (prev) {
-        prev->next = NULL;
-    } else {
-        *stk = NULL; // single-element case
-    }
-
-    ch_value val = cur->val;
-    free(cur);
-    ch_stk_push(&local, val);
-    return local;
+    ch_value val = ch_stk_pop_back(&top->value.stk);
+    ch_stack_push(full, val);
 }
 
-ch_stack_node *_mangle_(lst, "lst")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_STACK) {
+void _mangle_(lst, "lst")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STACK) {
         printf("ERR: '⊣' expected stack, got '%s'\n",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    if (local->val.value.stk == NULL) {
+    if (ch_stk_len(top->value.stk) == 0) {
         printf("ERR: '⊣' got empty stack");
         exit(1);
     }
-    ch_stack_node *stk = local->val.value.stk;
-    while (stk->next != NULL) {
-        stk = stk->next;
-    }
-    ch_value val = ch_valcpy(&stk->val);
-    ch_stk_push(&local, val);
-    return local;
+    ch_value val =
+        ch_deque_take(top->value.stk, top->value.stk->len - 1, 1);
+    ch_stack_push(full, val);
 }
 
-ch_stack_node *_mangle_(rot, "rot")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 3, 0);
-    ch_stack_node *bot = local->next->next;
-    local->next->next = NULL;
-    bot->next = local;
-    return bot;
-}
-
-ch_stack_node *_mangle_(nequ, "!=")(ch_stack_node **full) {
-    ch_stack_node *local = _mangle_(equ_cmp, "=")(full);
-    local->val.value.b = !local->val.value.b;
-    return local;
-}
-ch_stack_node *_mangle_(less, "<")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_lt_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     float b_val;
     if (b.kind == CH_VALK_INT) {
         b_val = b.value.i;
@@ -853,13 +1229,12 @@ ch_stack_node *_mangle_(less, "<")(ch_stack_node **full) {
         printf("ERR: '<' expected number, got '%s'\n", ch_valk_name(a.kind));
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_bool(a_val < b_val));
-    return local;
+    ch_stack_push(full, ch_valof_bool(a_val < b_val));
 }
-ch_stack_node *_mangle_(grt, ">")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_gt_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     float b_val;
     if (b.kind == CH_VALK_INT) {
         b_val = b.value.i;
@@ -878,13 +1253,12 @@ ch_stack_node *_mangle_(grt, ">")(ch_stack_node **full) {
         printf("ERR: '>' expected number, got '%s'\n", ch_valk_name(a.kind));
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_bool(a_val > b_val));
-    return local;
+    ch_stack_push(full, ch_valof_bool(a_val > b_val));
 }
-ch_stack_node *_mangle_(less_equ, "<=")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_le_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     float b_val;
     if (b.kind == CH_VALK_INT) {
         b_val = b.value.i;
@@ -903,13 +1277,12 @@ ch_stack_node *_mangle_(less_equ, "<=")(ch_stack_node **full) {
         printf("ERR: '<=' expected number, got '%s'\n", ch_valk_name(a.kind));
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_bool(a_val <= b_val));
-    return local;
+    ch_stack_push(full, ch_valof_bool(a_val <= b_val));
 }
-ch_stack_node *_mangle_(grt_equ, ">=")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_ge_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     float b_val;
     if (b.kind == CH_VALK_INT) {
         b_val = b.value.i;
@@ -928,257 +1301,220 @@ ch_stack_node *_mangle_(grt_equ, ">=")(ch_stack_node **full) {
         printf("ERR: '>=' expected number, got '%s'\n", ch_valk_name(a.kind));
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_bool(a_val >= b_val));
-    return local;
+    ch_stack_push(full, ch_valof_bool(a_val >= b_val));
 }
 
-ch_stack_node *_mangle_(mult, "*")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_mul_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     if (a.kind == CH_VALK_INT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_int(a.value.i * b.value.i));
+        ch_stack_push(full, ch_valof_int(a.value.i * b.value.i));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_float(a.value.f * b.value.i));
+        ch_stack_push(full, ch_valof_float(a.value.f * b.value.i));
     } else if (a.kind == CH_VALK_INT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(a.value.i * b.value.f));
+        ch_stack_push(full, ch_valof_float(a.value.i * b.value.f));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(a.value.f * b.value.f));
+        ch_stack_push(full, ch_valof_float(a.value.f * b.value.f));
     } else {
         printf("ERR: '*' expected two numbers, got '%s' and '%s'\n",
                ch_valk_name(a.kind), ch_valk_name(b.kind));
         exit(1);
     }
-    return local;
 }
-ch_stack_node *_mangle_(divd, "/")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_div_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     if (a.kind == CH_VALK_INT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_int(a.value.i / b.value.i));
+        ch_stack_push(full, ch_valof_int(a.value.i / b.value.i));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_float(a.value.f / b.value.i));
+        ch_stack_push(full, ch_valof_float(a.value.f / b.value.i));
     } else if (a.kind == CH_VALK_INT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(a.value.i / b.value.f));
+        ch_stack_push(full, ch_valof_float(a.value.i / b.value.f));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(a.value.f / b.value.f));
+        ch_stack_push(full, ch_valof_float(a.value.f / b.value.f));
     } else {
         printf("ERR: '/' expected two numbers, got '%s' and '%s'\n",
                ch_valk_name(a.kind), ch_valk_name(b.kind));
         exit(1);
     }
-    return local;
 }
-ch_stack_node *_mangle_(mod, "%")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void ch_mod_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     if (a.kind == CH_VALK_INT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_int(a.value.i % b.value.i));
+        ch_stack_push(full, ch_valof_int(a.value.i % b.value.i));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_INT) {
-        ch_stk_push(&local, ch_valof_float(fmodf(a.value.f, b.value.i)));
+        ch_stack_push(full, ch_valof_float(fmodf(a.value.f, b.value.i)));
     } else if (a.kind == CH_VALK_INT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(fmodf(a.value.f, b.value.i)));
+        ch_stack_push(full, ch_valof_float(fmodf(a.value.f, b.value.i)));
     } else if (a.kind == CH_VALK_FLOAT && b.kind == CH_VALK_FLOAT) {
-        ch_stk_push(&local, ch_valof_float(fmodf(a.value.f, b.value.i)));
+        ch_stack_push(full, ch_valof_float(fmodf(a.value.f, b.value.i)));
     } else {
         printf("ERR: '%%' expected two numbers, got '%s' and '%s'\n",
                ch_valk_name(a.kind), ch_valk_name(b.kind));
         exit(1);
     }
-    return local;
 }
 
-ch_stack_node *_mangle_(ins, "ins")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    if (local->next->val.kind != CH_VALK_STACK) {
+void ch_eq_ss(ch_stack *full) {
+    ch_value b = ch_stack_pop(full);
+    ch_value *a = ch_stack_peek(full, 0);
+    char equal = strcmp(ch_str_data(a->value.s), ch_str_data(b.value.s)) == 0;
+    ch_val_delete(a);
+    ch_val_delete(&b);
+    *a = ch_valof_bool(equal);
+}
+
+void ch_ne_ss(ch_stack *full) {
+    ch_eq_ss(full);
+    ch_value *top = ch_stack_peek(full, 0);
+    top->value.b = !top->value.b;
+}
+
+void _mangle_(ins, "ins")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    if (ch_stack_peek(full, 1)->kind != CH_VALK_STACK) {
         printf("ERR: 'ins' expected stack, got '%s'",
-               ch_valk_name(local->next->val.kind));
+               ch_valk_name(ch_stack_peek(full, 1)->kind));
         exit(1);
     }
-    ch_value val = ch_stk_pop(&local);
-    ch_stk_push(&local->val.value.stk, val);
-    return local;
-}
-
-ch_stack_node *_mangle_(rot_rev, "rot-")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 3, 0);
-    ch_stack_node *b = local->next;
-    ch_stack_node *c = b->next;
-    ch_stack_node *rest = c->next;
-    c->next = local;
-    local->next = rest;
-    return b;
+    ch_value val = ch_stack_pop(full);
+    ch_stk_push(&ch_stack_peek(full, 0)->value.stk, val);
 }
 
-ch_stack_node *_mangle_(ord, "ord")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_CHAR) {
+void _mangle_(ord, "ord")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_CHAR) {
         printf("ERR: 'ord' expected char, got '%s'",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    local->val.kind = CH_VALK_INT;
-    return local;
+    top->kind = CH_VALK_INT;
 }
 
-ch_stack_node *_mangle_(chr, "chr")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_INT) {
+void _mangle_(chr, "chr")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_INT) {
         printf("ERR: 'ord' expected int, got '%s'",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    local->val.kind = CH_VALK_CHAR;
-    return local;
+    top->kind = CH_VALK_CHAR;
 }
 
-ch_stack_node *_mangle_(and, "&&")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void _mangle_(and, "&&")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     if (b.kind != CH_VALK_BOOL || a.kind != CH_VALK_BOOL) {
         printf("ERR: '&&' expected two bools, got '%s' and '%s'",
                ch_valk_name(b.kind), ch_valk_name(a.kind));
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_bool(b.value.b && a.value.b));
-    return local;
+    ch_stack_push(full, ch_valof_bool(b.value.b && a.value.b));
 }
 
-ch_stack_node *_mangle_(or, "||")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void _mangle_(or, "||")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     if (b.kind != CH_VALK_BOOL || a.kind != CH_VALK_BOOL) {
         printf("ERR: '||' expected two bools, got '%s' and '%s'",
                ch_valk_name(b.kind), ch_valk_name(a.kind));
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_bool(b.value.b || a.value.b));
-    return local;
+    ch_stack_push(full, ch_valof_bool(b.value.b || a.value.b));
 }
 
-ch_stack_node *_mangle_(not, "!")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_BOOL) {
+void _mangle_(not, "!")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_BOOL) {
         printf("ERR: '!' expected bool, got '%s'",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    local->val.value.b = !local->val.value.b;
-    return local;
+    top->value.b = !top->value.b;
 }
 
-ch_stack_node *_mangle_(type_int, "int")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 0, 0);
-    ch_stk_push(&local, ch_valof_int(CH_VALK_INT));
-    return local;
+void _mangle_(type_int, "int")(ch_stack *full) {
+    ch_stack_push(full, ch_valof_int(CH_VALK_INT));
 }
-ch_stack_node *_mangle_(type_flt, "float")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 0, 0);
-    ch_stk_push(&local, ch_valof_int(CH_VALK_FLOAT));
-    return local;
+void _mangle_(type_flt, "float")(ch_stack *full) {
+    ch_stack_push(full, ch_valof_int(CH_VALK_FLOAT));
 }
-ch_stack_node *_mangle_(type_chr, "char")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 0, 0);
-    ch_stk_push(&local, ch_valof_int(CH_VALK_CHAR));
-    return local;
+void _mangle_(type_chr, "char")(ch_stack *full) {
+    ch_stack_push(full, ch_valof_int(CH_VALK_CHAR));
 }
-ch_stack_node *_mangle_(type_bool, "bool")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 0, 0);
-    ch_stk_push(&local, ch_valof_int(CH_VALK_BOOL));
-    return local;
+void _mangle_(type_bool, "bool")(ch_stack *full) {
+    ch_stack_push(full, ch_valof_int(CH_VALK_BOOL));
 }
-ch_stack_node *_mangle_(type_str, "string")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 0, 0);
-    ch_stk_push(&local, ch_valof_int(CH_VALK_STRING));
-    return local;
+void _mangle_(type_str, "string")(ch_stack *full) {
+    ch_stack_push(full, ch_valof_int(CH_VALK_STRING));
 }
-ch_stack_node *_mangle_(type_stk, "stack")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 0, 0);
-    ch_stk_push(&local, ch_valof_int(CH_VALK_STACK));
-    return local;
+void _mangle_(type_stk, "stack")(ch_stack *full) {
+    ch_stack_push(full, ch_valof_int(CH_VALK_STACK));
 }
-ch_stack_node *_mangle_(type_of, "type")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    ch_stk_push(&local, ch_valof_int(local->val.kind));
-    return local;
+void _mangle_(type_of, "type")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_stack_push(full, ch_valof_int(ch_stack_peek(full, 0)->kind));
 }
 
-ch_stack_node *_mangle_(dpt, "dpt")(ch_stack_node **full) {
-    size_t len = 0;
-    ch_stack_node *top = *full;
-    while (top != NULL) {
-        ++len;
-        top = top->next;
-    }
-    ch_stack_node *local = ch_stk_new();
-    ch_stk_push(&local, ch_valof_int(len));
-    return local;
+void _mangle_(dpt, "dpt")(ch_stack *full) {
+    ch_stack_push(full, ch_valof_int(full->len - full->base));
 }
 
-ch_stack_node *_mangle_(len, "len")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_STACK) {
+void _mangle_(len, "len")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STACK) {
         printf("ERR: 'len' expected stack, got '%s'\n",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    size_t len = 0;
-    ch_stack_node *top = local->val.value.stk;
-    while (top != NULL) {
-        ++len;
-        top = top->next;
-    }
-    ch_stk_push(&local, ch_valof_int(len));
-    return local;
+    ch_stack_push(full, ch_valof_int(ch_stk_len(top->value.stk)));
 }
 
-ch_stack_node *_mangle_(concat, "++")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value b = ch_stk_pop(&local);
-    ch_value a = ch_stk_pop(&local);
+void _mangle_(concat, "++")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value b = ch_stack_pop(full);
+    ch_value a = ch_stack_pop(full);
     if (b.kind != CH_VALK_STACK || a.kind != CH_VALK_STACK) {
         printf("ERR: '++' expected two stacks, got '%s' and '%s'",
                ch_valk_name(b.kind), ch_valk_name(a.kind));
         exit(1);
     }
     ch_stk_append(&b.value.stk, a.value.stk);
-    ch_stk_push(&local, b);
-    return local;
+    ch_stack_push(full, b);
 }
-void split_stack(ch_stack_node *stk, int n, ch_stack_node **taken,
-                 ch_stack_node **rest) {
+///! MOVES
+void split_stack(ch_deque *stk, int n, ch_deque **taken, ch_deque **rest) {
+    *taken = NULL;
     if (n <= 0) {
-        *taken = NULL;
         *rest = stk;
         return;
     }
 
-    ch_stack_node *cur = stk;
-    for (int i = 1; i < n; ++i) {
-        if (!cur) {
-            printf("ERR: expected %d elements but fell short", n);
-            exit(1);
-        }
-        cur = cur->next;
-    }
-
-    if (!cur) {
+    if (ch_stk_len(stk) < (size_t)n) {
         printf("ERR: expected %d elements but fell short", n);
         exit(1);
     }
 
-    *taken = stk;
-    *rest = cur->next;
-    cur->next = NULL;
+    *taken = ch_deque_alloc(stk->layout, n);
+    for (int i = 0; i < n; ++i) {
+        ch_stk_push_back(taken, ch_stk_pop(&stk));
+    }
+    *rest = stk;
 }
-ch_stack_node *_mangle_(take, "take")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value n = ch_stk_pop(&local);
-    ch_value s = ch_stk_pop(&local);
+void _mangle_(take, "take")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value n = ch_stack_pop(full);
+    ch_value s = ch_stack_pop(full);
 
     if (n.kind != CH_VALK_INT || s.kind != CH_VALK_STACK) {
         printf("ERR: 'take' expected int then stack, got '%s' then '%s'",
@@ -1186,17 +1522,16 @@ ch_stack_node *_mangle_(take, "take")(ch_stack_node **full) {
         exit(1);
     }
 
-    ch_stack_node *taken, *rest;
+    ch_deque *taken, *rest;
     split_stack(s.value.stk, n.value.i, &taken, &rest);
 
-    ch_stk_push(&local, ch_valof_stack(rest));
-    ch_stk_push(&local, ch_valof_stack(taken));
-    return local;
+    ch_stack_push(full, ch_valof_stack(rest));
+    ch_stack_push(full, ch_valof_stack(taken));
 }
-ch_stack_node *_mangle_(drop, "drop")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value n = ch_stk_pop(&local);
-    ch_value s = ch_stk_pop(&local);
+void _mangle_(drop, "drop")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value n = ch_stack_pop(full);
+    ch_value s = ch_stack_pop(full);
 
     if (n.kind != CH_VALK_INT || s.kind != CH_VALK_STACK) {
         printf("ERR: 'drop' expected int then stack, got '%s' then '%s'",
@@ -1204,99 +1539,140 @@ ch_stack_node *_mangle_(drop, "drop")(ch_stack_node **full) {
         exit(1);
     }
 
-    ch_stack_node *taken, *rest;
-    split_stack(s.value.stk, n.value.i, &taken, &rest);
-
-    while (taken) {
-        ch_stack_node *next = taken->next;
-        ch_val_delete(&taken->val);
-        free(taken);
-        taken = next;
+    if (n.value.i > 0) {
+        if (ch_stk_len(s.value.stk) < (size_t)n.value.i) {
+            printf("ERR: expected %d elements but fell short", n.value.i);
+            exit(1);
+        }
+        ch_stk_own(&s.value.stk);
+        ch_deque *stk = s.value.stk;
+        if (stk->layout == CH_DEQUE_BOXED) {
+            for (int i = 0; i < n.value.i; ++i) {
+                ch_val_delete(ch_stk_at(stk, i));
+            }
+        }
+        stk->head = (stk->head + n.value.i) & (stk->cap - 1);
+        stk->len -= n.value.i;
     }
 
-    ch_stk_push(&local, ch_valof_stack(rest));
-    return local;
+    ch_stack_push(full, s);
 }
-ch_stack_node *_mangle_(rev, "rev")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_STACK) {
+void _mangle_(rev, "rev")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STACK) {
         printf("ERR: 'rev' expected stack, got %s",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
+        exit(1);
+    }
+    ch_stk_own(&top->value.stk);
+    ch_deque *stk = top->value.stk;
+    size_t len = ch_stk_len(stk);
+    if (stk && stk->layout == CH_DEQUE_BOXED) {
+        for (size_t i = 0; i < len / 2; ++i) {
+            ch_value *a = ch_stk_at(stk, i);
+            ch_value *b = ch_stk_at(stk, len - 1 - i);
+            ch_value tmp = *a;
+            *a = *b;
+            *b = tmp;
+        }
+    } else if (stk && stk->layout != CH_DEQUE_BOOL) {
+        int32_t *words = (int32_t *)stk->data;
+        size_t mask = stk->cap - 1;
+        for (size_t i = 0; i < len / 2; ++i) {
+            int32_t *a = &words[(stk->head + i) & mask];
+            int32_t *b = &words[(stk->head + len - 1 - i) & mask];
+            int32_t tmp = *a;
+            *a = *b;
+            *b = tmp;
+        }
+    } else {
+        for (size_t i = 0; i < len / 2; ++i) {
+            ch_value a = ch_stk_get(stk, i);
+            ch_deque_set(stk, i, ch_stk_get(stk, len - 1 - i));
+            ch_deque_set(stk, len - 1 - i, a);
+        }
+    }
+}
+
+void _mangle_(nth, "nth")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value n = ch_stack_pop(full);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (n.kind != CH_VALK_INT || top->kind != CH_VALK_STACK) {
+        printf("ERR: 'nth' expected int then stack, got '%s' then '%s'",
+               ch_valk_name(n.kind), ch_valk_name(top->kind));
         exit(1);
     }
-    ch_stack_node *prev = NULL;
-    ch_stack_node *stk = local->val.value.stk;
-    while (stk) {
-        ch_stack_node *next = stk->next;
-        stk->next = prev;
-        prev = stk;
-        stk = next;
+    if (n.value.i < 0 || (size_t)n.value.i >= ch_stk_len(top->value.stk)) {
+        printf("ERR: 'nth' index '%d' is out of bounds\n", n.value.i);
+        exit(1);
     }
-    local->val.value.stk = prev;
-    return local;
+    ch_stack_push(full, ch_deque_take(top->value.stk, n.value.i, 1));
 }
 
-ch_stack_node *_mangle_(is_null, "null")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_STACK) {
+void _mangle_(is_null, "null")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STACK) {
         printf("ERR: 'null' expected stack, got '%s'",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_bool(local->val.value.stk == NULL));
-    return local;
+    ch_stack_push(full, ch_valof_bool(ch_stk_len(top->value.stk) == 0));
 }
 
-ch_stack_node *_mangle_(str, "str")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    ch_value val = ch_stk_pop(&local);
+void _mangle_(str, "str")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value val = ch_stack_pop(full);
     ch_string str = print_value_str(val);
     ch_val_delete(&val);
-    ch_stk_push(&local, ch_valof_string(str));
-    return local;
+    ch_stack_push(full, ch_valof_string(str));
 }
 
-ch_stack_node *_mangle_(slen, "slen")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    if (local->val.kind != CH_VALK_STRING) {
+void ch_slen_any(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STRING) {
         printf("ERR: 'slen' expected string, got %s",
-               ch_valk_name(local->val.kind));
+               ch_valk_name(top->kind));
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_int(local->val.value.s.len));
-    return local;
+    ch_stack_push(full, ch_valof_int(ch_str_len(top->value.s)));
 }
 
-ch_stack_node *_mangle_(strget, "@")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value index = ch_stk_pop(&local);
-    if (local->val.kind != CH_VALK_STRING || index.kind != CH_VALK_INT) {
+void ch_strget_any(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value index = ch_stack_pop(full);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STRING || index.kind != CH_VALK_INT) {
         printf("ERR: '@' expected int and string, got %s and %s",
-               ch_valk_name(index.kind), ch_valk_name(local->val.kind));
+               ch_valk_name(index.kind), ch_valk_name(top->kind));
         exit(1);
     }
     size_t bytes;
-    int code = utf8_nth_char(&local->val.value.s, index.value.i);
+    int code = utf8_nth_char(top->value.s, index.value.i);
     if (bytes < 0) {
         printf("ERR: '@' failed to read char, possible out of bound access.");
         exit(1);
     }
-    ch_stk_push(&local, ch_valof_char(code));
-    return local;
+    ch_stack_push(full, ch_valof_char(code));
 }
 
-ch_stack_node *_mangle_(strset, "@!")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 3, 0);
-    ch_value index = ch_stk_pop(&local);
-    ch_value ch = ch_stk_pop(&local);
-    ch_string *string = &local->val.value.s;
-    if (local->val.kind != CH_VALK_STRING || index.kind != CH_VALK_INT ||
+void _mangle_(strset, "@!")(ch_stack *full) {
+    ch_stack_need(full, 3);
+    ch_value index = ch_stack_pop(full);
+    ch_value ch = ch_stack_pop(full);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STRING || index.kind != CH_VALK_INT ||
         ch.kind != CH_VALK_CHAR) {
         printf("ERR: '@!' expected int,string,char; got %s,%s,%s",
-               ch_valk_name(index.kind), ch_valk_name(local->val.kind),
-               ch_valk_name(local->val.kind));
+               ch_valk_name(index.kind), ch_valk_name(top->kind),
+               ch_valk_name(top->kind));
         exit(1);
     }
+    ch_val_own_string(top);
+    ch_string *string = top->value.s;
     ssize_t byte_idx = utf8_nth_index(string, index.value.i);
     if (byte_idx < 0) {
         printf("ERR: '@!' failed to read char, possible out of bound access.");
@@ -1305,95 +1681,90 @@ ch_stack_node *_mangle_(strset, "@!")(ch_stack_node **full) {
     ch_string s = encode_utf8(ch.value.i);
     ch_str_replace(string, byte_idx, 1, &s);
     ch_str_delete(&s);
-    return local;
 }
 
-ch_stack_node *_mangle_(strapp, "&")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value s2 = ch_stk_pop(&local);
-    ch_value s1 = ch_stk_pop(&local);
+void _mangle_(strapp, "&")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value s2 = ch_stack_pop(full);
+    ch_value s1 = ch_stack_pop(full);
     if (s1.kind != CH_VALK_STRING || s2.kind != CH_VALK_STRING) {
         printf("ERR: '&' expected string and string, got %s and %s",
                ch_valk_name(s1.kind), ch_valk_name(s2.kind));
         exit(1);
     }
-    ch_str_append(&s1.value.s, &s2.value.s);
+    ch_val_own_string(&s1);
+    ch_str_append(s1.value.s, s2.value.s);
     ch_val_delete(&s2);
-    ch_stk_push(&local, s1);
-    return local;
+    ch_stack_push(full, s1);
 }
 
-ch_stack_node *_mangle_(strpush, ".")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value c = ch_stk_pop(&local);
-    ch_value s = ch_stk_pop(&local);
+void _mangle_(strpush, ".")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value c = ch_stack_pop(full);
+    ch_value s = ch_stack_pop(full);
     if (c.kind != CH_VALK_CHAR || s.kind != CH_VALK_STRING) {
         printf("ERR: '.' expected char and string, got %s and %s",
                ch_valk_name(c.kind), ch_valk_name(s.kind));
         exit(1);
     }
+    ch_val_own_string(&s);
     ch_string ap = encode_utf8(c.value.i);
-    ch_str_append(&s.value.s, &ap);
+    ch_str_append(s.value.s, &ap);
     ch_str_delete(&ap);
-    ch_stk_push(&local, s);
-    return local;
+    ch_stack_push(full, s);
 }
 
-ch_stack_node *_mangle_(strpop, ".!")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    ch_value s = ch_stk_pop(&local);
+void _mangle_(strpop, ".!")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value s = ch_stack_pop(full);
     if (s.kind != CH_VALK_STRING) {
         printf("ERR: '.!' expected string, got %s", ch_valk_name(s.kind));
         exit(1);
     }
-    int c = ch_str_pop(&s.value.s);
+    ch_val_own_string(&s);
+    int c = ch_str_pop(s.value.s);
     if (c == -1) {
         printf("ERR: '.!' failed to decode UTF8\n");
         exit(1);
     }
-    ch_stk_push(&local, s);
-    ch_stk_push(&local, ch_valof_char(c));
-    return local;
+    ch_stack_push(full, s);
+    ch_stack_push(full, ch_valof_char(c));
 }
 
-ch_stack_node *_mangle_(fnapply, "ap")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 1, 0);
-    ch_value val = ch_stk_pop(&local);
+void _mangle_(fnapply, "ap")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value val = ch_stack_pop(full);
     if (val.kind != CH_VALK_FUNCTION) {
         printf("ERR: 'ap' expected function, got %s", ch_valk_name(val.kind));
         exit(1);
     }
-    ch_stack_node *ret = val.value.fn(full);
-    ch_stk_append(full, ret);
-    return NULL;
+    val.value.fn(full);
 }
 
-ch_stack_node *_mangle_(fntail, "tail")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value val = ch_stk_pop(&local);
+void _mangle_(fntail, "tail")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value val = ch_stack_pop(full);
     if (val.kind != CH_VALK_FUNCTION) {
         printf("ERR: 'tail' expected function, got %s", ch_valk_name(val.kind));
         exit(1);
     }
-    ch_stack_node *ret = val.value.fn(full);
-    ch_stk_append(full, ret);
-    return local;
+    ch_value kept = ch_stack_pop(full);
+    val.value.fn(full);
+    ch_stack_push(full, kept);
 }
 
-ch_stack_node *_mangle_(repeat, "repeat")(ch_stack_node **full) {
-    ch_stack_node *local = ch_stk_args(full, 2, 0);
-    ch_value count = ch_stk_pop(&local);
-    ch_value fn = ch_stk_pop(&local);
+void _mangle_(repeat, "repeat")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value count = ch_stack_pop(full);
+    ch_value fn = ch_stack_pop(full);
     if (count.kind != CH_VALK_INT || fn.kind != CH_VALK_FUNCTION) {
         printf("ERR: 'repeat' expected int and function, got %s and %s",
                ch_valk_name(count.kind), ch_valk_name(fn.kind));
         exit(1);
     }
     for (int i = 0; i < count.value.i; ++i) {
-        ch_stack_node *ret = fn.value.fn(full);
-        ch_stk_append(full, ret);
+        fn.value.fn(full);
     }
-    return NULL;
 }
 
 ch_type_info *ch_type_table = NULL;
@@ -1,9 +1,10 @@
 #pragma once
 #include <stddef.h>
+#include <stdint.h>
 
 #define _mangle_(x, a) x
 
-typedef enum : size_t {
+typedef enum : uint32_t {
     CH_VALK_INT,
     CH_VALK_FLOAT,
     CH_VALK_BOOL,
@@ -17,16 +18,69 @@ typedef enum : size_t {
 
 const char *ch_valk_name(ch_value_kind k);
 
-typedef struct {
-    char *data;
-    size_t len;
-    size_t size;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "ch_string's inline tag assumes a little endian target"
+#endif
+
+// Strings of up to `CH_STR_INLINE` bytes are stored inside the struct. The
+// inline `tag` overlaps the top byte of `size`, which a capacity never
+// reaches. Its high bit marks the inline form and the rest holds the length.
+// On heap strings `CH_STR_SHARED_BIT` marks a refcounted copy-on-write
+// buffer owned by the runtime, `CH_STR_STATIC_BIT` a literal of the program
+// in static storage that is never written or freed, without either `data`
+// is a plain `malloc` block.
+#define CH_STR_INLINE 22
+#define CH_STR_INLINE_BIT 0x80
+#define CH_STR_SHARED_BIT 0x40
+#define CH_STR_STATIC_BIT 0x20
+
+typedef union {
+    struct {
+        char *data;
+        size_t len;
+        size_t size;
+    };
+    struct {
+        char buf[CH_STR_INLINE + 1];
+        unsigned char tag;
+    } small;
 } ch_string;
 
+// Initializer of the static string of the `n` bytes of the literal `lit`
+#define CH_STR_LITERAL(lit, n)                                                 \
+    {                                                                          \
+        .data = (char *)(lit), .len = (n),                                     \
+        .size = (size_t)CH_STR_STATIC_BIT << (8 * (sizeof(size_t) - 1))        \
+    }
+
+static inline char ch_str_is_inline(ch_string const *str) {
+    return (str->small.tag & CH_STR_INLINE_BIT) != 0;
+}
+
+static inline char *ch_str_data(ch_string const *str) {
+    return ch_str_is_inline(str) ? (char *)str->small.buf : str->data;
+}
+
+static inline size_t ch_str_len(ch_string const *str) {
+    return ch_str_is_inline(str) ? str->small.tag & (CH_STR_INLINE_BIT - 1)
+                                 : str->len;
+}
+
 ch_string ch_str_new(char const *data);
 
+ch_string ch_str_new_len(char const *data, size_t len);
+
+// Always heap backed, so `data` may be written and `len` set directly
 ch_string ch_str_alloc(size_t len);
 
+// Moves the string to a heap buffer it owns alone, so `data` may be written
+// and `len` read directly
+void ch_str_heap(ch_string *str);
+
+// O(1) for inline and shared strings, a plain heap string is moved into a
+// shared buffer first
+ch_string ch_str_copy(ch_string *str);
+
 void ch_str_push(ch_string *str, char c);
 int ch_str_pop(ch_string *str);
 
@@ -35,241 +89,680 @@ void ch_str_replace(ch_string *str, size_t pos, size_t n, ch_string const *rep);
 
 void ch_str_delete(ch_string *str);
 
-struct ch_stack_node;
+struct ch_deque;
+typedef struct ch_stack ch_stack;
 
+// A kind tag and one word of payload, strings are kept out of line in a
+// runtime owned `ch_string`
 typedef struct {
     ch_value_kind kind;
     union {
         int i;
         float f;
         char b;
-        ch_string s;
-        struct ch_stack_node *stk;
+        ch_string *s;
+        struct ch_deque *stk;
         void *op;
-        struct ch_stack_node *(*fn)(struct ch_stack_node **);
+        void (*fn)(ch_stack *);
     } value;
 } ch_value;
 
-ch_value ch_valof_int(int n);
+_Static_assert(sizeof(ch_value) == 16, "ch_value should be two words");
 
-ch_value ch_valof_float(float n);
+static inline ch_value ch_valof_int(int n) {
+    return (ch_value){.kind = CH_VALK_INT, .value.i = n};
+}
+
+static inline ch_value ch_valof_float(float n) {
+    return (ch_value){.kind = CH_VALK_FLOAT, .value.f = n};
+}
 
 // UTF32 codepoint
-ch_value ch_valof_char(int n);
+static inline ch_value ch_valof_char(int n) {
+    return (ch_value){.kind = CH_VALK_CHAR, .value.i = n};
+}
 
 ch_value ch_valof_string(ch_string n);
 
-ch_value ch_valof_bool(char n);
+// Value of a `CH_STR_LITERAL` string, which every copy shares. Builtins
+// writing to the string take a copy of their own first, see
+// `ch_val_own_string`
+static inline ch_value ch_valof_literal(ch_string const *lit) {
+    return (ch_value){.kind = CH_VALK_STRING, .value.s = (ch_string *)lit};
+}
 
-ch_value ch_valof_stack(struct ch_stack_node *n);
+static inline ch_value ch_valof_bool(char n) {
+    return (ch_value){.kind = CH_VALK_BOOL, .value.b = n};
+}
 
-ch_value ch_valof_opaque(void *ptr);
+static inline ch_value ch_valof_stack(struct ch_deque *n) {
+    return (ch_value){.kind = CH_VALK_STACK, .value.stk = n};
+}
 
-ch_value
-ch_valof_function(struct ch_stack_node *(*fn)(struct ch_stack_node **));
+static inline ch_value ch_valof_opaque(void *ptr) {
+    return (ch_value){.kind = CH_VALK_OPAQUE, .value.op = ptr};
+}
 
-char ch_valas_bool(ch_value v);
+static inline ch_value ch_valof_function(void (*fn)(ch_stack *)) {
+    return (ch_value){.kind = CH_VALK_FUNCTION, .value.fn = fn};
+}
 
-void ch_val_delete(ch_value *val);
+// Reports a value of the wrong kind and exits
+_Noreturn void ch_val_expected(ch_value_kind want, ch_value_kind got);
 
-ch_value ch_valcpy(ch_value const *v);
+static inline char ch_valas_bool(ch_value v) {
+    if (v.kind != CH_VALK_BOOL) {
+        ch_val_expected(CH_VALK_BOOL, v.kind);
+    }
+    return v.value.b;
+}
 
-typedef struct ch_stack_node {
-    ch_value val;
-    struct ch_stack_node *next;
-} ch_stack_node;
+static inline int ch_valas_int(ch_value v) {
+    if (v.kind != CH_VALK_INT) {
+        ch_val_expected(CH_VALK_INT, v.kind);
+    }
+    return v.value.i;
+}
 
-ch_stack_node *ch_stk_new();
+///! MOVES the string out of `v`
+ch_string ch_valas_string(ch_value v);
 
-void ch_stk_push(ch_stack_node **stk, ch_value val);
+// Gives the string value `val` a payload of its own, which may be written
+// in place. Required before any `ch_str_*` function writes to the string of
+// a value, which may be a read-only literal
+void ch_val_own_string(ch_value *val);
 
-ch_value ch_stk_pop(ch_stack_node **stk);
+// Whether the payload lives outside the value, copies and deletes of any
+// other value are plain word moves
+static inline char ch_val_is_boxed(ch_value const *val) {
+    return val->kind >= CH_VALK_STRING && val->kind != CH_VALK_FUNCTION;
+}
 
-ch_stack_node *ch_stk_copy(ch_stack_node *stk);
+void ch_val_delete_boxed(ch_value *val);
 
-ch_stack_node *ch_stk_args(ch_stack_node **from, size_t n, char is_rest);
+static inline void ch_val_delete(ch_value *val) {
+    if (ch_val_is_boxed(val)) {
+        ch_val_delete_boxed(val);
+    }
+    val->kind = -1;
+}
 
-void ch_stk_append(ch_stack_node **to, ch_stack_node *from);
+ch_value ch_valcpy_boxed(ch_value const *v);
 
-void ch_stk_delete(ch_stack_node **stk);
+static inline ch_value ch_valcpy(ch_value const *v) {
+    return ch_val_is_boxed(v) ? ch_valcpy_boxed(v) : *v;
+}
 
-ch_stack_node *_mangle_(print, "print")(ch_stack_node **full);
+// Fixed size-class allocator, carves elements out of `CH_SLAB_LEN` sized
+// chunks and recycles freed elements through an intrusive free list
+#define CH_SLAB_LEN 256
 
-ch_stack_node *_mangle_(dup, "dup")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(dup2, "⇈")(ch_stack_node **full) {
-    return _mangle_(dup, "dup")(full);
-}
-ch_stack_node *_mangle_(swp, "swp")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(swp2, "↕")(ch_stack_node **full) {
-    return _mangle_(swp, "swp")(full);
-}
-ch_stack_node *_mangle_(swpd, "swpd")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(swpd2, "↨")(ch_stack_node **full) {
-    return _mangle_(swpd, "swpd")(full);
-}
-ch_stack_node *_mangle_(tck, "tck")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(tck2, "⊻")(ch_stack_node **full) {
-    return _mangle_(tck, "tck")(full);
-}
-ch_stack_node *_mangle_(over, "ovr")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(over2, "⊼")(ch_stack_node **full) {
-    return _mangle_(over, "ovr")(full);
-}
-ch_stack_node *_mangle_(rot, "rot")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(rot2, "↻")(ch_stack_node **full) {
-    return _mangle_(rot, "rot")(full);
-}
-ch_stack_node *_mangle_(rot_rev, "rot-")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(rot_rev2, "↷")(ch_stack_node **full) {
-    return _mangle_(rot_rev, "rot-")(full);
-}
-ch_stack_node *_mangle_(pick, "pck")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(pick2, "⩞")(ch_stack_node **full) {
-    return _mangle_(pick, "pck")(full);
-}
-ch_stack_node *_mangle_(nip, "nip")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(nip2, "⦵")(ch_stack_node **full) {
-    return _mangle_(nip, "nip")(full);
-}
+typedef struct ch_slab {
+    size_t size;
+    void *free;
+    void *chunks;
+    char *bump;
+    char *end;
+    size_t fresh;
+    size_t recycled;
+} ch_slab;
+
+void *ch_slab_alloc(ch_slab *slab);
+
+void ch_slab_free(ch_slab *slab, void *ptr);
+
+// Element storage of a boxed stack. Stacks the checker proved to hold a
+// single scalar type are packed: ints and floats as 32 bit words, chars as
+// UTF-32 codepoints and bools as a bitset. Any other value pushed onto a
+// packed stack turns it back into `CH_DEQUE_BOXED` `ch_value`s.
+typedef enum : size_t {
+    CH_DEQUE_BOXED,
+    CH_DEQUE_INT,
+    CH_DEQUE_FLOAT,
+    CH_DEQUE_CHAR,
+    CH_DEQUE_BOOL,
+} ch_deque_layout;
+
+// Boxed stacks are ring buffers shared copy-on-write between their copies,
+// `NULL` is the empty stack. Element 0 is the top (`⊢`) and `len - 1` the
+// bottom (`⊣`), `cap` is always a power of two.
+typedef struct ch_deque {
+    size_t refs;
+    size_t head;
+    size_t len;
+    size_t cap;
+    ch_deque_layout layout;
+    ch_value data[];
+} ch_deque;
 
-ch_stack_node *_mangle_(dbg, "dbg")(ch_stack_node **full);
+// Deques of up to `CH_DEQUE_SMALL << (CH_DEQUE_CLASSES - 1)` elements come
+// from per-thread slabs, one per capacity
+#define CH_DEQUE_SMALL 4
+#define CH_DEQUE_CLASSES 3
 
-ch_stack_node *_mangle_(equ_cmp, "=")(ch_stack_node **full);
-ch_stack_node *_mangle_(nequ, "!=")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(nequ2, "≠")(ch_stack_node **full) {
-    return _mangle_(nequ, "!=")(full);
-}
-ch_stack_node *_mangle_(less, "<")(ch_stack_node **full);
-ch_stack_node *_mangle_(grt, ">")(ch_stack_node **full);
-ch_stack_node *_mangle_(less_equ, "<=")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(less_equ2, "≤")(ch_stack_node **full) {
-    return _mangle_(less_equ, "<=")(full);
+// Allocators of the calling thread, for the `fresh`/`recycled` counters
+ch_slab const *ch_stk_slabs();
+
+static inline size_t ch_stk_len(ch_deque const *stk) {
+    return stk ? stk->len : 0;
 }
-ch_stack_node *_mangle_(grt_equ, ">=")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(grt_equ2, "≥")(ch_stack_node **full) {
-    return _mangle_(grt_equ, ">=")(full);
+
+// `i` 0 is the top, the element must not be modified unless `stk` is owned.
+// Only valid on `CH_DEQUE_BOXED` stacks, see `ch_stk_unpack`
+static inline ch_value *ch_stk_at(ch_deque const *stk, size_t i) {
+    return (ch_value *)&stk->data[(stk->head + i) & (stk->cap - 1)];
 }
 
-ch_stack_node *_mangle_(add, "+")(ch_stack_node **full);
-ch_stack_node *_mangle_(sub, "-")(ch_stack_node **full);
-ch_stack_node *_mangle_(mult, "*")(ch_stack_node **full);
-ch_stack_node *_mangle_(divd, "/")(ch_stack_node **full);
-ch_stack_node *_mangle_(mod, "%")(ch_stack_node **full);
+// Element `i` of a stack of any layout, borrowed from `stk`
+ch_value ch_stk_get(ch_deque const *stk, size_t i);
 
-ch_stack_node *_mangle_(boxstk, "box")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(boxstk2, "▭")(ch_stack_node **full) {
-    return _mangle_(boxstk, "box")(full);
-}
+// Converts a packed stack to `CH_DEQUE_BOXED`
+void ch_stk_unpack(ch_deque **stk);
 
-ch_stack_node *_mangle_(flat, "flat")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(flat2, "⬚")(ch_stack_node **full) {
-    return _mangle_(flat, "flat")(full);
-}
+ch_deque *ch_stk_new();
 
-ch_stack_node *_mangle_(pop, "pop")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(pop2, "◌")(ch_stack_node **full) {
-    return _mangle_(pop, "pop")(full);
-}
+void ch_stk_push(ch_deque **stk, ch_value val);
 
-ch_stack_node *_mangle_(fst_pop, "fst!")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(fst_pop2, "⊢!")(ch_stack_node **full) {
-    return _mangle_(fst_pop, "fst!")(full);
-}
-ch_stack_node *_mangle_(fst, "fst")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(fst2, "⊢")(ch_stack_node **full) {
-    return _mangle_(fst, "fst")(full);
-}
+ch_value ch_stk_pop(ch_deque **stk);
 
-ch_stack_node *_mangle_(lst_pop, "lst!")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(lst_pop2, "⊣!")(ch_stack_node **full) {
-    return _mangle_(lst_pop, "lst!")(full);
-}
-ch_stack_node *_mangle_(lst, "lst")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(lst2, "⊣")(ch_stack_node **full) {
-    return _mangle_(lst, "lst")(full);
-}
-ch_stack_node *_mangle_(ins, "ins")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(ins2, "⤓")(ch_stack_node **full) {
-    return _mangle_(ins, "ins")(full);
-}
+void ch_stk_push_back(ch_deque **stk, ch_value val);
 
-ch_stack_node *_mangle_(ord, "ord")(ch_stack_node **full);
-ch_stack_node *_mangle_(chr, "chr")(ch_stack_node **full);
+ch_value ch_stk_pop_back(ch_deque **stk);
 
-ch_stack_node *_mangle_(and, "&&")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(and2, "∧")(ch_stack_node **full) {
-    return _mangle_(and, "&&")(full);
-}
-ch_stack_node *_mangle_(or, "||")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(or2, "∨")(ch_stack_node **full) {
-    return _mangle_(or, "||")(full);
-}
-ch_stack_node *_mangle_(not, "!")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(not2, "¬")(ch_stack_node **full) {
-    return _mangle_(not, "!")(full);
-}
+// O(1), shares the buffer with `stk`
+ch_deque *ch_stk_copy(ch_deque *stk);
 
-ch_stack_node *_mangle_(type_int, "int")(ch_stack_node **full);
-ch_stack_node *_mangle_(type_flt, "float")(ch_stack_node **full);
-ch_stack_node *_mangle_(type_chr, "char")(ch_stack_node **full);
-ch_stack_node *_mangle_(type_bool, "bool")(ch_stack_node **full);
-ch_stack_node *_mangle_(type_str, "string")(ch_stack_node **full);
-ch_stack_node *_mangle_(type_stk, "stack")(ch_stack_node **full);
-ch_stack_node *_mangle_(type_of, "type")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(type_of2, "∈")(ch_stack_node **full) {
-    return _mangle_(type_of, "type")(full);
-}
+// Copies the buffer if it is shared, so `stk` may be modified in place
+void ch_stk_own(ch_deque **stk);
 
-ch_stack_node *_mangle_(dpt, "dpt")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(dpt2, "≡")(ch_stack_node **full) {
-    return _mangle_(dpt, "dpt")(full);
-}
-ch_stack_node *_mangle_(len, "len")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(len2, "⧺")(ch_stack_node **full) {
-    return _mangle_(len, "len")(full);
-}
-ch_stack_node *_mangle_(is_null, "null")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(is_null2, "∘")(ch_stack_node **full) {
-    return _mangle_(is_null, "null")(full);
-}
+///! MOVES, `from` ends up on top of `to`
+void ch_stk_append(ch_deque **to, ch_deque *from);
 
-ch_stack_node *_mangle_(concat, "++")(ch_stack_node **full);
-ch_stack_node *_mangle_(take, "take")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(take2, "↙")(ch_stack_node **full) {
-    return _mangle_(take, "take")(full);
-}
-ch_stack_node *_mangle_(drop, "drop")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(drop2, "↘")(ch_stack_node **full) {
-    return _mangle_(drop, "drop")(full);
+void ch_stk_delete(ch_deque **stk);
+
+// Contiguous program stack shared by every call, `data[len - 1]` is the top
+// and `data[base]` the bottom of the running function's frame
+struct ch_stack {
+    ch_value *data;
+    size_t len;
+    size_t size;
+    size_t base;
+    // Function a tail call left to run, see `CH_TAIL_CALL`
+    void (*next)(struct ch_stack *);
+};
+
+ch_stack ch_stack_new();
+
+void ch_stack_reserve(ch_stack *stk, size_t extra);
+
+static inline void ch_stack_push(ch_stack *stk, ch_value val) {
+    if (stk->len == stk->size) {
+        ch_stack_reserve(stk, 1);
+    }
+    stk->data[stk->len++] = val;
 }
-ch_stack_node *_mangle_(rev, "rev")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(rev2, "⇆")(ch_stack_node **full) {
-    return _mangle_(rev, "rev")(full);
+
+static inline ch_value ch_stack_pop(ch_stack *stk) {
+    return stk->data[--stk->len];
 }
 
-ch_stack_node *_mangle_(str, "str")(ch_stack_node **full);
-ch_stack_node *_mangle_(slen, "slen")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(slen2, "ℓ")(ch_stack_node **full) {
-    return _mangle_(slen, "slen")(full);
+// `depth` 0 is the top
+static inline ch_value *ch_stack_peek(ch_stack *stk, size_t depth) {
+    return &stk->data[stk->len - 1 - depth];
+}
+
+// Reports a frame holding fewer than `n` values and exits
+_Noreturn void ch_stack_underflow(ch_stack *stk, size_t n);
+
+// Exits when the frame holds fewer than `n` values
+static inline void ch_stack_need(ch_stack *stk, size_t n) {
+    if (stk->len - stk->base < n) {
+        ch_stack_underflow(stk, n);
+    }
 }
-ch_stack_node *_mangle_(strget, "@")(ch_stack_node **full);
-ch_stack_node *_mangle_(strset, "@!")(ch_stack_node **full);
-ch_stack_node *_mangle_(strapp, "&")(ch_stack_node **full);
-ch_stack_node *_mangle_(strpush, ".")(ch_stack_node **full);
-ch_stack_node *_mangle_(strpop, ".!")(ch_stack_node **full);
 
-ch_stack_node *_mangle_(fnapply, "ap")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(fnapply2, "▷")(ch_stack_node **full) {
-    return _mangle_(fnapply, "ap")(full);
+// Starts a frame at the top `n` values, with `is_rest` the rest of the
+// caller's frame is boxed beneath them. Returns the caller's base
+size_t ch_stack_enter(ch_stack *stk, size_t n, char is_rest);
+
+// Ends a frame keeping its top `n` values, the rest is dropped or with
+// `is_rest` boxed beneath them
+void ch_stack_leave(ch_stack *stk, size_t base, size_t n, char is_rest);
+
+// Runs `fn` on `stk`, then any tail calls it leaves behind
+static inline void ch_call(void (*fn)(ch_stack *), ch_stack *stk) {
+    fn(stk);
+    while (stk->next) {
+        fn = stk->next;
+        stk->next = NULL;
+        fn(stk);
+    }
+}
+
+// Returns through `fn`, as a jump where the compiler can guarantee one.
+// Otherwise `fn` is left in `stk` for the nearest `CH_CALL` below to run, so
+// a chain of tail calls still takes constant C stack
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define CH_TAIL_CALL(fn, stk) __attribute__((musttail)) return fn(stk)
+#define CH_CALL(fn, stk) fn(stk)
+#endif
+#endif
+#ifndef CH_TAIL_CALL
+#define CH_TAIL_CALL(fn, stk)                                                  \
+    do {                                                                       \
+        (stk)->next = (fn);                                                    \
+        return;                                                                \
+    } while (0)
+#define CH_CALL(fn, stk) ch_call(fn, stk)
+#endif
+
+///! MOVES, the arguments of a call as a deque, see `ch_stack_enter`
+ch_deque *ch_stack_pop_args(ch_stack *stk, size_t n, char is_rest);
+
+///! MOVES the frame, top of `stk` becomes element 0
+ch_deque *ch_stack_to_deque(ch_stack *stk);
+
+///! MOVES, like `ch_stack_to_deque` but packed when every value is a `kind`
+ch_deque *ch_stack_to_deque_as(ch_stack *stk, ch_value_kind kind);
+
+///! MOVES, element 0 becomes top of `stk`
+void ch_stack_from_deque(ch_stack *stk, ch_deque *deque);
+
+void ch_stack_delete(ch_stack *stk);
+
+void _mangle_(print, "print")(ch_stack *full);
+
+// The shuffles, operators, `ℓ` and `@` below are defined here so they
+// inline into generated code. Each handles the common case itself and leaves
+// anything else, errors included, to an out of line `_any` variant
+
+static inline void _mangle_(dup, "dup")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_stack_push(full, ch_valcpy(ch_stack_peek(full, 0)));
+}
+static inline void _mangle_(dup2, "⇈")(ch_stack *full) {
+    _mangle_(dup, "dup")(full);
+}
+static inline void _mangle_(swp, "swp")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value *args = full->data + full->len - 2;
+    ch_value top = args[1];
+    args[1] = args[0];
+    args[0] = top;
+}
+static inline void _mangle_(swp2, "↕")(ch_stack *full) {
+    _mangle_(swp, "swp")(full);
+}
+static inline void _mangle_(swpd, "swpd")(ch_stack *full) {
+    ch_stack_need(full, 3);
+    ch_value *args = full->data + full->len - 3;
+    ch_value bot = args[0];
+    args[0] = args[1];
+    args[1] = bot;
+}
+static inline void _mangle_(swpd2, "↨")(ch_stack *full) {
+    _mangle_(swpd, "swpd")(full);
+}
+static inline void _mangle_(tck, "tck")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_stack_push(full, *ch_stack_peek(full, 0));
+    ch_value *args = full->data + full->len - 3;
+    args[1] = args[0];
+    args[0] = ch_valcpy(&args[2]);
+}
+static inline void _mangle_(tck2, "⊻")(ch_stack *full) {
+    _mangle_(tck, "tck")(full);
+}
+static inline void _mangle_(over, "ovr")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_stack_push(full, ch_valcpy(ch_stack_peek(full, 1)));
+}
+static inline void _mangle_(over2, "⊼")(ch_stack *full) {
+    _mangle_(over, "ovr")(full);
+}
+static inline void _mangle_(rot, "rot")(ch_stack *full) {
+    ch_stack_need(full, 3);
+    ch_value *args = full->data + full->len - 3;
+    ch_value bot = args[0];
+    args[0] = args[1];
+    args[1] = args[2];
+    args[2] = bot;
+}
+static inline void _mangle_(rot2, "↻")(ch_stack *full) {
+    _mangle_(rot, "rot")(full);
+}
+static inline void _mangle_(rot_rev, "rot-")(ch_stack *full) {
+    ch_stack_need(full, 3);
+    ch_value *args = full->data + full->len - 3;
+    ch_value top = args[2];
+    args[2] = args[1];
+    args[1] = args[0];
+    args[0] = top;
+}
+static inline void _mangle_(rot_rev2, "↷")(ch_stack *full) {
+    _mangle_(rot_rev, "rot-")(full);
+}
+static inline void _mangle_(pick, "pck")(ch_stack *full) {
+    ch_stack_need(full, 3);
+    ch_stack_push(full, ch_valcpy(ch_stack_peek(full, 2)));
+}
+static inline void _mangle_(pick2, "⩞")(ch_stack *full) {
+    _mangle_(pick, "pck")(full);
+}
+static inline void _mangle_(nip, "nip")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value top = ch_stack_pop(full);
+    ch_val_delete(ch_stack_peek(full, 0));
+    *ch_stack_peek(full, 0) = top;
+}
+static inline void _mangle_(nip2, "⦵")(ch_stack *full) {
+    _mangle_(nip, "nip")(full);
+}
+
+void _mangle_(dbg, "dbg")(ch_stack *full);
+
+// Typed entry points of the operators below, used by the compiler when the
+// checker knows both operand kinds. They don't check their operands, suffixes
+// name the kinds bottom first: i int, f float, c char, b bool, s string.
+// `a` is left in place as the result slot, `b` is taken off the stack
+#define CH_TYPED_OPERANDS                                                      \
+    ch_value b = full->data[--full->len];                                      \
+    ch_value *a = &full->data[full->len - 1]
+
+#define CH_TYPED_ARITHM(name, op)                                              \
+    static inline void ch_##name##_ii(ch_stack *full) {                        \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_int(a->value.i op b.value.i);                            \
+    }                                                                          \
+    static inline void ch_##name##_if(ch_stack *full) {                        \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_float(a->value.i op b.value.f);                          \
+    }                                                                          \
+    static inline void ch_##name##_fi(ch_stack *full) {                        \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_float(a->value.f op b.value.i);                          \
+    }                                                                          \
+    static inline void ch_##name##_ff(ch_stack *full) {                        \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_float(a->value.f op b.value.f);                          \
+    }
+
+// Promotes to float like the generic comparisons
+#define CH_TYPED_COMPARE(name, op)                                             \
+    static inline void ch_##name##_ii(ch_stack *full) {                        \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_bool((float)a->value.i op(float) b.value.i);             \
+    }                                                                          \
+    static inline void ch_##name##_if(ch_stack *full) {                        \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_bool((float)a->value.i op b.value.f);                    \
+    }                                                                          \
+    static inline void ch_##name##_fi(ch_stack *full) {                        \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_bool(a->value.f op(float) b.value.i);                    \
+    }                                                                          \
+    static inline void ch_##name##_ff(ch_stack *full) {                        \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_bool(a->value.f op b.value.f);                           \
+    }
+
+#define CH_TYPED_EQUAL(kind, field)                                            \
+    static inline void ch_eq_##kind##kind(ch_stack *full) {                    \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_bool(a->value.field == b.value.field);                   \
+    }                                                                          \
+    static inline void ch_ne_##kind##kind(ch_stack *full) {                    \
+        CH_TYPED_OPERANDS;                                                     \
+        *a = ch_valof_bool(a->value.field != b.value.field);                   \
+    }
+
+CH_TYPED_ARITHM(add, +)
+CH_TYPED_ARITHM(sub, -)
+CH_TYPED_ARITHM(mul, *)
+CH_TYPED_ARITHM(div, /)
+CH_TYPED_COMPARE(lt, <)
+CH_TYPED_COMPARE(gt, >)
+CH_TYPED_COMPARE(le, <=)
+CH_TYPED_COMPARE(ge, >=)
+CH_TYPED_EQUAL(i, i)
+CH_TYPED_EQUAL(f, f)
+CH_TYPED_EQUAL(c, i)
+CH_TYPED_EQUAL(b, b)
+
+static inline void ch_mod_ii(ch_stack *full) {
+    CH_TYPED_OPERANDS;
+    *a = ch_valof_int(a->value.i % b.value.i);
+}
+
+void ch_eq_ss(ch_stack *full);
+void ch_ne_ss(ch_stack *full);
+
+#undef CH_TYPED_OPERANDS
+#undef CH_TYPED_ARITHM
+#undef CH_TYPED_COMPARE
+#undef CH_TYPED_EQUAL
+
+// Whether the top two values are both `kind`
+static inline char ch_stack_both(ch_stack *full, ch_value_kind kind) {
+    return full->data[full->len - 1].kind == kind &&
+           full->data[full->len - 2].kind == kind;
+}
+
+// Generic operators on two ints inline, any other kinds go out of line
+#define CH_INT_OPERATOR(builtin, typed)                                        \
+    void ch_##typed##_any(ch_stack *full);                                     \
+    static inline void builtin(ch_stack *full) {                               \
+        ch_stack_need(full, 2);                                                \
+        if (ch_stack_both(full, CH_VALK_INT)) {                                \
+            ch_##typed##_ii(full);                                             \
+        } else {                                                               \
+            ch_##typed##_any(full);                                            \
+        }                                                                      \
+    }
+
+CH_INT_OPERATOR(_mangle_(less, "<"), lt)
+CH_INT_OPERATOR(_mangle_(grt, ">"), gt)
+CH_INT_OPERATOR(_mangle_(less_equ, "<="), le)
+CH_INT_OPERATOR(_mangle_(grt_equ, ">="), ge)
+CH_INT_OPERATOR(_mangle_(add, "+"), add)
+CH_INT_OPERATOR(_mangle_(sub, "-"), sub)
+CH_INT_OPERATOR(_mangle_(mult, "*"), mul)
+CH_INT_OPERATOR(_mangle_(divd, "/"), div)
+CH_INT_OPERATOR(_mangle_(mod, "%"), mod)
+
+#undef CH_INT_OPERATOR
+
+static inline void _mangle_(less_equ2, "≤")(ch_stack *full) {
+    _mangle_(less_equ, "<=")(full);
+}
+static inline void _mangle_(grt_equ2, "≥")(ch_stack *full) {
+    _mangle_(grt_equ, ">=")(full);
+}
+
+void ch_eq_any(ch_stack *full);
+static inline void _mangle_(equ_cmp, "=")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value const *b = ch_stack_peek(full, 0);
+    if (b->kind != ch_stack_peek(full, 1)->kind) {
+        ch_eq_any(full);
+        return;
+    }
+    switch (b->kind) {
+    case CH_VALK_INT:
+    case CH_VALK_CHAR:
+        ch_eq_ii(full);
+        break;
+    case CH_VALK_FLOAT:
+        ch_eq_ff(full);
+        break;
+    case CH_VALK_BOOL:
+        ch_eq_bb(full);
+        break;
+    default:
+        ch_eq_any(full);
+        break;
+    }
+}
+static inline void _mangle_(nequ, "!=")(ch_stack *full) {
+    _mangle_(equ_cmp, "=")(full);
+    ch_value *top = ch_stack_peek(full, 0);
+    top->value.b = !top->value.b;
+}
+static inline void _mangle_(nequ2, "≠")(ch_stack *full) {
+    _mangle_(nequ, "!=")(full);
+}
+
+void _mangle_(boxstk, "box")(ch_stack *full);
+static inline void _mangle_(boxstk2, "▭")(ch_stack *full) {
+    _mangle_(boxstk, "box")(full);
+}
+// `box` of a stack the checker proved to only hold `kind` values
+void ch_boxstk_as(ch_stack *full, ch_value_kind kind);
+
+void _mangle_(flat, "flat")(ch_stack *full);
+static inline void _mangle_(flat2, "⬚")(ch_stack *full) {
+    _mangle_(flat, "flat")(full);
+}
+
+static inline void _mangle_(pop, "pop")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_val_delete(&full->data[--full->len]);
+}
+static inline void _mangle_(pop2, "◌")(ch_stack *full) {
+    _mangle_(pop, "pop")(full);
+}
+
+void _mangle_(fst_pop, "fst!")(ch_stack *full);
+static inline void _mangle_(fst_pop2, "⊢!")(ch_stack *full) {
+    _mangle_(fst_pop, "fst!")(full);
+}
+void _mangle_(fst, "fst")(ch_stack *full);
+static inline void _mangle_(fst2, "⊢")(ch_stack *full) {
+    _mangle_(fst, "fst")(full);
+}
+
+void _mangle_(lst_pop, "lst!")(ch_stack *full);
+static inline void _mangle_(lst_pop2, "⊣!")(ch_stack *full) {
+    _mangle_(lst_pop, "lst!")(full);
+}
+void _mangle_(lst, "lst")(ch_stack *full);
+static inline void _mangle_(lst2, "⊣")(ch_stack *full) {
+    _mangle_(lst, "lst")(full);
+}
+void _mangle_(ins, "ins")(ch_stack *full);
+static inline void _mangle_(ins2, "⤓")(ch_stack *full) {
+    _mangle_(ins, "ins")(full);
+}
+
+void _mangle_(ord, "ord")(ch_stack *full);
+void _mangle_(chr, "chr")(ch_stack *full);
+
+void _mangle_(and, "&&")(ch_stack *full);
+static inline void _mangle_(and2, "∧")(ch_stack *full) {
+    _mangle_(and, "&&")(full);
+}
+void _mangle_(or, "||")(ch_stack *full);
+static inline void _mangle_(or2, "∨")(ch_stack *full) {
+    _mangle_(or, "||")(full);
+}
+void _mangle_(not, "!")(ch_stack *full);
+static inline void _mangle_(not2, "¬")(ch_stack *full) {
+    _mangle_(not, "!")(full);
+}
+
+void _mangle_(type_int, "int")(ch_stack *full);
+void _mangle_(type_flt, "float")(ch_stack *full);
+void _mangle_(type_chr, "char")(ch_stack *full);
+void _mangle_(type_bool, "bool")(ch_stack *full);
+void _mangle_(type_str, "string")(ch_stack *full);
+void _mangle_(type_stk, "stack")(ch_stack *full);
+void _mangle_(type_of, "type")(ch_stack *full);
+static inline void _mangle_(type_of2, "∈")(ch_stack *full) {
+    _mangle_(type_of, "type")(full);
+}
+
+void _mangle_(dpt, "dpt")(ch_stack *full);
+static inline void _mangle_(dpt2, "≡")(ch_stack *full) {
+    _mangle_(dpt, "dpt")(full);
+}
+void _mangle_(len, "len")(ch_stack *full);
+static inline void _mangle_(len2, "⧺")(ch_stack *full) {
+    _mangle_(len, "len")(full);
+}
+void _mangle_(is_null, "null")(ch_stack *full);
+static inline void _mangle_(is_null2, "∘")(ch_stack *full) {
+    _mangle_(is_null, "null")(full);
+}
+
+void _mangle_(concat, "++")(ch_stack *full);
+void _mangle_(take, "take")(ch_stack *full);
+static inline void _mangle_(take2, "↙")(ch_stack *full) {
+    _mangle_(take, "take")(full);
+}
+void _mangle_(drop, "drop")(ch_stack *full);
+static inline void _mangle_(drop2, "↘")(ch_stack *full) {
+    _mangle_(drop, "drop")(full);
 }
-ch_stack_node *_mangle_(fntail, "tail")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(fntail2, "⟜")(ch_stack_node **full) {
-    return _mangle_(fntail, "tail")(full);
+void _mangle_(rev, "rev")(ch_stack *full);
+static inline void _mangle_(rev2, "⇆")(ch_stack *full) {
+    _mangle_(rev, "rev")(full);
 }
+void _mangle_(nth, "nth")(ch_stack *full);
 
-ch_stack_node *_mangle_(repeat, "repeat")(ch_stack_node **full);
-static inline ch_stack_node *_mangle_(repeat2, "⋄")(ch_stack_node **full) {
-    return _mangle_(repeat, "repeat")(full);
+void _mangle_(str, "str")(ch_stack *full);
+void ch_slen_any(ch_stack *full);
+static inline void _mangle_(slen, "slen")(ch_stack *full) {
+    ch_stack_need(full, 1);
+    ch_value *top = ch_stack_peek(full, 0);
+    if (top->kind != CH_VALK_STRING) {
+        ch_slen_any(full);
+        return;
+    }
+    ch_stack_push(full, ch_valof_int(ch_str_len(top->value.s)));
+}
+static inline void _mangle_(slen2, "ℓ")(ch_stack *full) {
+    _mangle_(slen, "slen")(full);
+}
+// Inline while the string is ASCII up to the index, the general case decodes
+// UTF-8 out of line
+void ch_strget_any(ch_stack *full);
+static inline void _mangle_(strget, "@")(ch_stack *full) {
+    ch_stack_need(full, 2);
+    ch_value *top = ch_stack_peek(full, 1);
+    ch_value index = *ch_stack_peek(full, 0);
+    if (top->kind == CH_VALK_STRING && index.kind == CH_VALK_INT &&
+        index.value.i >= 0 && (size_t)index.value.i < ch_str_len(top->value.s)) {
+        unsigned char const *data =
+            (unsigned char const *)ch_str_data(top->value.s);
+        size_t i = 0;
+        while (i < (size_t)index.value.i && data[i] < 0x80) {
+            ++i;
+        }
+        if (i == (size_t)index.value.i && data[i] < 0x80) {
+            full->data[full->len - 1] = ch_valof_char(data[i]);
+            return;
+        }
+    }
+    ch_strget_any(full);
+}
+void _mangle_(strset, "@!")(ch_stack *full);
+void _mangle_(strapp, "&")(ch_stack *full);
+void _mangle_(strpush, ".")(ch_stack *full);
+void _mangle_(strpop, ".!")(ch_stack *full);
+
+void _mangle_(fnapply, "ap")(ch_stack *full);
+static inline void _mangle_(fnapply2, "▷")(ch_stack *full) {
+    _mangle_(fnapply, "ap")(full);
+}
+void _mangle_(fntail, "tail")(ch_stack *full);
+static inline void _mangle_(fntail2, "⟜")(ch_stack *full) {
+    _mangle_(fntail, "tail")(full);
+}
+
+void _mangle_(repeat, "repeat")(ch_stack *full);
+static inline void _mangle_(repeat2, "⋄")(ch_stack *full) {
+    _mangle_(repeat, "repeat")(full);
 }
 // panic
 
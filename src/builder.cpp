@@ -1,12 +1,15 @@
 #include "builder.hpp"
 #include "checks.hpp"
+#include "effects.hpp"
 #include "make_c.hpp"
 #include "parser.hpp"
+#include "passes.hpp"
 #include "traverser.hpp"
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <print>
+#include <ranges>
 
 std::vector<parser::TopLevel> builder::Builder::parse() {
     try {
@@ -20,27 +23,48 @@ std::vector<parser::TopLevel> builder::Builder::parse() {
     return {};
 }
 
+static std::string show(std::vector<ir::Instruction> &irs) {
+    std::string listing{};
+    for (auto &i : irs) {
+        listing += std::format("  {}\n", i.show());
+    }
+    return listing + "\n\n";
+}
+
 std::vector<traverser::Function> builder::Builder::traverse() {
     std::vector<traverser::Function> fns{};
     auto decls = parse();
     if (show_ir) {
         std::println("\n== IR ==");
     }
+    effects::Table functions{};
+    for (auto &decl : decls) {
+        if (auto fn = std::get_if<parser::FnDecl>(&decl)) {
+            if (fn->args.kind == parser::Argument::Limited && !fn->rets.rest)
+                functions.emplace(fn->name,
+                                  effects::Effect{fn->args.args.size(),
+                                                  fn->rets.args.size(), false});
+        } else if (auto type = std::get_if<parser::TypeDecl>(&decl)) {
+            std::size_t fields = type->body.size();
+            functions.emplace(type->name, effects::Effect{0, 1, true});
+            functions.emplace(type->name + "!",
+                              effects::Effect{fields, 1, true});
+            for (auto &[field, _] : type->body) {
+                functions.emplace(type->name + "." + field,
+                                  effects::Effect{1, 2, true});
+                functions.emplace(type->name + "." + field + "!",
+                                  effects::Effect{2, 1, true});
+            }
+        }
+    }
     for (auto &decl : decls) {
         if (auto fn = std::get_if<parser::FnDecl>(&decl)) {
             try {
                 if (auto grid = std::get_if<parser::Grid>(&fn->body)) {
-                    auto ir = traverser::traverse(*grid);
-                    if (show_ir) {
-                        std::println("fn {}\n", fn->name);
-                        for (auto &i : ir) {
-                            std::println("  {}", i.show());
-                        }
-                        std::println("\n");
-                    }
-                    fns.emplace_back(
-                        traverser::Function{fn->name, fn->args, fn->rets, ir,
-                                            traverser::Function::Native});
+                    fns.emplace_back(traverser::Function{
+                        fn->name, fn->args, fn->rets,
+                        traverser::traverse(*grid),
+                        traverser::Function::Native});
                 } else if (auto ffi = std::get_if<std::string>(&fn->body)) {
                     fns.emplace_back(
                         traverser::Function{fn->name, fn->args, fn->rets, *ffi,
@@ -56,19 +80,81 @@ std::vector<traverser::Function> builder::Builder::traverse() {
             type_decls.emplace_back(*type);
         }
     }
-    if (show_ir) {
-        std::println("== End IR ==\n");
-    }
+    // Errors are reported on the program as written, the passes assume it
+    // is well typed and may drop or hide the instructions at fault
     try {
-        checks::TypeChecker(fns, show_typecheck, type_decls).check();
+        facts = checks::TypeChecker(fns, show_typecheck, type_decls).check();
     } catch (checks::CheckError e) {
         error(std::format("In {}: {}", e.fname, e.what));
     }
+    passes::Callees callees{};
+    for (auto &fn : fns) {
+        if (fn.kind == traverser::Function::Native &&
+            fn.args.kind == parser::Argument::Limited && !fn.rets.rest)
+            callees.emplace(fn.name,
+                            passes::Callee{
+                                fn.args.args.size(), fn.rets.args.size(),
+                                &std::get<std::vector<ir::Instruction>>(
+                                    fn.body)});
+    }
+    auto pipeline = passes::pipeline(optimization, functions, callees);
+    pass_counts.emplace_back("traverse", 0);
+    for (auto &pass : pipeline) {
+        pass_counts.emplace_back(pass.name, 0);
+    }
+    // Listings of each function after traversal and each pass. Each pass
+    // runs on every function before the next one, so the inliner splices
+    // callees as far along the pipeline as their callers
+    std::vector<std::string> listings(fns.size());
+    for (std::size_t i = 0; i <= pipeline.size(); ++i) {
+        for (std::size_t f = 0; f < fns.size(); ++f) {
+            if (fns[f].kind != traverser::Function::Native)
+                continue;
+            auto &ir = std::get<std::vector<ir::Instruction>>(fns[f].body);
+            if (i > 0)
+                pipeline[i - 1].run(ir);
+            pass_counts[i].second += passes::count(ir);
+            if (show_ir) {
+                if (i > 0)
+                    listings[f] +=
+                        std::format("-- after {}\n\n", pipeline[i - 1].name);
+                listings[f] += show(ir);
+            }
+        }
+    }
+    if (show_ir) {
+        for (std::size_t f = 0; f < fns.size(); ++f) {
+            if (fns[f].kind == traverser::Function::Native)
+                std::print("fn {}\n\n{}", fns[f].name, listings[f]);
+        }
+        std::println("== End IR ==\n");
+        std::println("== Passes ==");
+        for (auto [i, count] : pass_counts | std::ranges::views::enumerate) {
+            if (i == 0) {
+                std::println("  {}: {}", count.first, count.second);
+            } else {
+                long change = static_cast<long>(count.second) -
+                              static_cast<long>(pass_counts[i - 1].second);
+                std::println("  {}: {} ({}{})", count.first, count.second,
+                             change > 0 ? "+" : "", change);
+            }
+        }
+        std::println("== End Passes ==\n");
+    }
+    // Facts are keyed by instruction, so they come from checking the IR the
+    // backend is given
+    if (!pipeline.empty()) {
+        try {
+            facts = checks::TypeChecker(fns, false, type_decls).check();
+        } catch (checks::CheckError e) {
+            error(std::format("In {}, after optimizing: {}", e.fname, e.what));
+        }
+    }
     return fns;
 }
 std::string builder::Builder::generate() {
     auto fns = traverse();
-    std::string code{backend::c::make_c(fns, c_includes, type_decls)};
+    std::string code{backend::c::make_c(fns, c_includes, type_decls, facts)};
     if (show_gen) {
         std::println("\n== Source ==");
         std::println("{}", code);
@@ -195,3 +281,7 @@ builder::Builder &builder::Builder::dry() {
     is_dry_run = !is_dry_run;
     return *this;
 }
+builder::Builder &builder::Builder::optimize(int level) {
+    optimization = level;
+    return *this;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "checks.hpp"
 #include "parser.hpp"
 #include "traverser.hpp"
 #include <filesystem>
@@ -11,11 +12,15 @@ class Builder {
     std::string custom_args{};
     std::vector<std::string> c_includes{};
     std::vector<parser::TypeDecl> type_decls{};
+    checks::Facts facts{};
     bool show_ir{false};
     bool show_gen{false};
     bool show_command{false};
     bool show_typecheck{false};
     bool is_dry_run{false};
+    int optimization{1};
+    // Instructions in the program after traversal, then after each pass
+    std::vector<std::pair<std::string, std::size_t>> pass_counts{};
 
     void error(std::size_t start, std::size_t end, std::string what);
     void error(std::string what);
@@ -37,6 +42,7 @@ class Builder {
     Builder &cmd();
     Builder &type();
     Builder &dry();
+    Builder &optimize(int level);
     Builder &set_args(std::string const &args);
 };
 } // namespace builder
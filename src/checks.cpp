@@ -3,6 +3,7 @@
 #include "parser.hpp"
 #include "traverser.hpp"
 #include "utf.hpp"
+#include <algorithm>
 #include <cassert>
 #include <format>
 #include <memory>
@@ -182,6 +183,39 @@ bool is_matching(checks::Type const &got, checks::Type const &expect,
     return got.kind == expect.kind;
 }
 
+// Builtins the runtime has typed entry points for, see `note_operands`
+static std::unordered_set<std::string> const operators{
+    "+", "-", "*", "/", "%", "<", ">", "<=", ">=", "≤", "≥", "=", "!=", "≠"};
+
+// Type of the value a literal push leaves
+static checks::Type literal_type(ir::Instruction const &instr) {
+    switch (instr.kind) {
+    case ir::Instruction::PushInt:
+        return checks::Type{checks::Type::Int, {}};
+    case ir::Instruction::PushFloat:
+        return checks::Type{checks::Type::Float, {}};
+    case ir::Instruction::PushChar:
+        return checks::Type{checks::Type::Char, {}};
+    case ir::Instruction::PushStr:
+        return checks::Type{checks::Type::String, {}};
+    case ir::Instruction::PushBool:
+        return checks::Type{checks::Type::Bool,
+                            std::optional<bool>{std::get<bool>(instr.value)}};
+    case ir::Instruction::PushStack: {
+        // Bottom first, like the frame `▭` boxes
+        std::vector<checks::Type> elems{};
+        for (auto const &elem :
+             std::get<std::vector<ir::Instruction>>(instr.value)) {
+            elems.insert(elems.begin(), literal_type(elem));
+        }
+        return tstack(elems);
+    }
+    default:
+        assert(false && "Not a literal");
+        return checks::Type{checks::Type::Int, {}};
+    }
+}
+
 struct State {
     size_t ip;
     std::vector<checks::Type> stack;
@@ -231,14 +265,52 @@ checks::Type collapse_union(std::vector<checks::Type> const &types) {
     return tunion(uniq);
 }
 
+// `type` with every known bool in it, nested ones included, unknown
+static checks::Type forget_bools(checks::Type const &type) {
+    switch (type.kind) {
+    case checks::Type::Bool:
+        return tbool({});
+    case checks::Type::Many:
+        return tmany(
+            forget_bools(*std::get<std::shared_ptr<checks::Type>>(type.value)));
+    case checks::Type::Union: {
+        std::vector<checks::Type> options{};
+        for (auto const &option :
+             std::get<std::vector<checks::Type>>(type.value))
+            options.emplace_back(forget_bools(option));
+        return tunion(options);
+    }
+    case checks::Type::Stack: {
+        auto elems =
+            std::get<std::optional<std::vector<checks::Type>>>(type.value);
+        if (elems) {
+            for (auto &elem : *elems)
+                elem = forget_bools(elem);
+        }
+        return tstack(elems);
+    }
+    default:
+        return type;
+    }
+}
+
+// Merges `now` into the stack `prev` seen before at a label, whether that
+// changed it. Matching ignores known bools, so those that differ are
+// forgotten: a branch on one must be followed both ways from then on
 bool unify(std::vector<checks::Type> &prev,
            std::vector<checks::Type> const &now) {
     auto p = prev.rbegin();
     auto n = now.rbegin();
     std::vector<checks::Type> suffix{};
+    bool forgot = false;
     for (; p != prev.rend() && n != now.rend(); ++p, ++n) {
         if (is_matching(*n, *p)) {
-            suffix.emplace_back(*p);
+            if (n->show() == p->show()) {
+                suffix.emplace_back(*p);
+                continue;
+            }
+            suffix.emplace_back(forget_bools(*p));
+            forgot = forgot || suffix.back().show() != p->show();
         } else {
             suffix.emplace_back(tunion({*n, *p}));
         }
@@ -261,10 +333,10 @@ bool unify(std::vector<checks::Type> &prev,
 
         checks::Type t = collapse_union(extras);
 
-        result.emplace_back(tmany(t));
+        result.emplace_back(tmany(forget_bools(t)));
     }
 
-    if (stk_equals(result, prev)) {
+    if (!forgot && stk_equals(result, prev)) {
         return false;
     }
 
@@ -280,6 +352,33 @@ checks::TypeChecker::run_stack(std::vector<checks::Type> from,
     std::unordered_map<int, std::vector<Type>> visited{};
     std::vector<std::vector<checks::Type>> exits{};
 
+    // Follows `?` to `label` or past it, both ways unless the bool is known.
+    // Adds the taken branch as a new state, so `state` may dangle after
+    auto branch = [&](State &state, std::string const &label) {
+        if (state.stack.empty())
+            throw CheckError(name, "Branch expected 'bool', got nothing");
+        if (!is_matching(state.stack.back(), tbool({}))) {
+            throw CheckError(name,
+                             std::format("Branch expected 'bool', got '{}'",
+                                         state.stack.back().show()));
+        }
+        auto t = stack_pop(state.stack);
+        std::optional<bool> b{};
+        if (t->kind == Type::Bool)
+            b = std::get<std::optional<bool>>(t->value);
+        if (&irs == checking)
+            note_branch(name, state.ip, b);
+        if (b && *b) {
+            state.ip = to_label(irs, label);
+            return;
+        } else if (b && !*b) {
+            ++state.ip;
+            return;
+        }
+        ++state.ip;
+        states.emplace_back(State{to_label(irs, label), state.stack});
+    };
+
     while (!states.empty()) {
         auto &state = states.back();
 
@@ -295,6 +394,10 @@ checks::TypeChecker::run_stack(std::vector<checks::Type> from,
         }
 
         auto instr = irs[state.ip];
+        if (&irs == checking) {
+            note_frame(name, state.ip, state.stack);
+            reached[name].emplace(state.ip);
+        }
         if (show_trace) {
             std::println("On : {}", instr.show());
             std::println("States : {} | Stack : {}", states.size(),
@@ -302,24 +405,12 @@ checks::TypeChecker::run_stack(std::vector<checks::Type> from,
         }
         switch (instr.kind) {
         case ir::Instruction::PushInt:
-            state.stack.emplace_back(Type{Type::Int, {}});
-            ++state.ip;
-            break;
         case ir::Instruction::PushFloat:
-            state.stack.emplace_back(Type{Type::Float, {}});
-            ++state.ip;
-            break;
         case ir::Instruction::PushChar:
-            state.stack.emplace_back(Type{Type::Char, {}});
-            ++state.ip;
-            break;
         case ir::Instruction::PushStr:
-            state.stack.emplace_back(Type{Type::String, {}});
-            ++state.ip;
-            break;
         case ir::Instruction::PushBool:
-            state.stack.emplace_back(Type{
-                Type::Bool, std::optional<bool>{std::get<bool>(instr.value)}});
+        case ir::Instruction::PushStack:
+            state.stack.emplace_back(literal_type(instr));
             ++state.ip;
             break;
         case ir::Instruction::Call: {
@@ -327,32 +418,31 @@ checks::TypeChecker::run_stack(std::vector<checks::Type> from,
             if (!signatures.contains(callee))
                 throw CheckError(name,
                                  "Call to undefined function '" + callee + "'");
+            if (&irs == checking && (callee == "box" || callee == "▭"))
+                note_box(name, state.ip, state.stack);
+            if (&irs == checking && operators.contains(callee))
+                note_operands(name, state.ip, state.stack);
             (*signatures[callee])(*this, state.stack);
             ++state.ip;
             break;
         }
-        case ir::Instruction::JumpTrue: {
-            auto label = std::get<std::string>(instr.value);
-            if (state.stack.empty())
-                throw CheckError(name, "Branch expected 'bool', got nothing");
-            if (!is_matching(state.stack.back(), tbool({}))) {
-                throw CheckError(name,
-                                 std::format("Branch expected 'bool', got '{}'",
-                                             state.stack.back().show()));
-            }
-            auto t = stack_pop(state.stack);
-            if (t->kind == Type::Bool) {
-                auto b = std::get<std::optional<bool>>(t->value);
-                if (b && *b) {
-                    state.ip = to_label(irs, label);
-                    break;
-                } else if (b && !*b) {
-                    ++state.ip;
-                    break;
+        case ir::Instruction::JumpTrue:
+            branch(state, std::get<std::string>(instr.value));
+            break;
+        case ir::Instruction::JumpCompare: {
+            auto const &parts = std::get<std::vector<ir::Instruction>>(instr.value);
+            for (auto const &part : parts) {
+                if (part.kind == ir::Instruction::Call) {
+                    auto callee = std::get<std::string>(part.value);
+                    if (&irs == checking)
+                        note_operands(name, state.ip, state.stack);
+                    (*signatures[callee])(*this, state.stack);
+                } else if (part.kind == ir::Instruction::JumpTrue) {
+                    branch(state, std::get<std::string>(part.value));
+                } else {
+                    state.stack.emplace_back(literal_type(part));
                 }
             }
-            ++state.ip;
-            states.emplace_back(State{to_label(irs, label), state.stack});
             break;
         }
         case ir::Instruction::Goto:
@@ -387,7 +477,102 @@ checks::TypeChecker::run_stack(std::vector<checks::Type> from,
     return exits;
 }
 
-void checks::TypeChecker::check() {
+// The one scalar kind every value of `stack` has, if there is one
+static std::optional<checks::Type::Kind>
+element_kind(std::vector<checks::Type> const &stack) {
+    std::optional<checks::Type::Kind> kind{};
+    for (auto const &type : stack) {
+        auto const *elem = &type;
+        if (elem->kind == checks::Type::Many)
+            elem = std::get<std::shared_ptr<checks::Type>>(elem->value).get();
+        switch (elem->kind) {
+        case checks::Type::Int:
+        case checks::Type::Float:
+        case checks::Type::Char:
+        case checks::Type::Bool:
+            break;
+        default:
+            return std::nullopt;
+        }
+        if (kind && *kind != elem->kind)
+            return std::nullopt;
+        kind = elem->kind;
+    }
+    return kind;
+}
+
+void checks::TypeChecker::note_box(std::string const &name, size_t ip,
+                                   std::vector<Type> const &stack) {
+    auto kind = element_kind(stack);
+    auto &seen = box_kinds[name];
+    // Every path reaching the call has to agree
+    if (seen.contains(ip) && seen.at(ip) != kind)
+        kind = std::nullopt;
+    seen.insert_or_assign(ip, kind);
+}
+
+// Kinds of `stack` when every value in it is a scalar
+static std::optional<std::vector<checks::Type::Kind>>
+scalar_kinds(std::vector<checks::Type> const &stack) {
+    std::vector<checks::Type::Kind> kinds{};
+    for (auto const &type : stack) {
+        switch (type.kind) {
+        case checks::Type::Int:
+        case checks::Type::Float:
+        case checks::Type::Char:
+        case checks::Type::Bool:
+            kinds.emplace_back(type.kind);
+            break;
+        default:
+            return std::nullopt;
+        }
+    }
+    return kinds;
+}
+
+void checks::TypeChecker::note_frame(std::string const &name, size_t ip,
+                                     std::vector<Type> const &stack) {
+    auto kinds = scalar_kinds(stack);
+    auto &seen = frame_kinds[name];
+    if (seen.contains(ip) && seen.at(ip) != kinds)
+        kinds = std::nullopt;
+    seen.insert_or_assign(ip, kinds);
+}
+
+void checks::TypeChecker::note_operands(std::string const &name, size_t ip,
+                                        std::vector<Type> const &stack) {
+    auto concrete = [](Type const &type) {
+        switch (type.kind) {
+        case Type::Int:
+        case Type::Float:
+        case Type::Char:
+        case Type::Bool:
+        case Type::String:
+            return true;
+        default:
+            return false;
+        }
+    };
+    std::optional<std::pair<Type::Kind, Type::Kind>> kinds{};
+    if (stack.size() >= 2 && concrete(stack.end()[-2]) &&
+        concrete(stack.back()))
+        kinds = std::pair{stack.end()[-2].kind, stack.back().kind};
+    auto &seen = operand_kinds[name];
+    if (seen.contains(ip) && seen.at(ip) != kinds)
+        kinds = std::nullopt;
+    seen.insert_or_assign(ip, kinds);
+}
+
+void checks::TypeChecker::note_branch(std::string const &name, size_t ip,
+                                      std::optional<bool> taken) {
+    auto &seen = branches[name];
+    if (seen.contains(ip) && seen.at(ip) != taken)
+        taken = std::nullopt;
+    seen.insert_or_assign(ip, taken);
+}
+
+checks::Facts checks::TypeChecker::check() {
+    Facts facts{};
     for (auto &[name, decl] : decls) {
         if (decl.kind != traverser::Function::Native)
             continue;
@@ -401,7 +586,13 @@ void checks::TypeChecker::check() {
         if (decl.args.kind == parser::Argument::Ellipses) {
             from.insert(from.begin(), tstack(std::nullopt));
         }
+        checking = &irs;
         auto exits = run_stack(from, name, irs);
+        checking = nullptr;
+        for (size_t ip = 0; ip < irs.size(); ++ip) {
+            if (!reached[name].contains(ip))
+                facts.unreached[name].emplace(ip);
+        }
         for (auto &stack : exits) {
             for (auto ret = to.rbegin(); ret != to.rend(); ++ret) {
                 if (stack.empty())
@@ -417,6 +608,36 @@ void checks::TypeChecker::check() {
             }
         }
     }
+
+    for (auto const &[name, boxes] : box_kinds) {
+        for (auto const &[ip, kind] : boxes) {
+            if (kind)
+                facts.box_kinds[name].emplace(ip, *kind);
+        }
+    }
+    for (auto const &[name, calls] : operand_kinds) {
+        for (auto const &[ip, kinds] : calls) {
+            if (kinds)
+                facts.operand_kinds[name].emplace(ip, *kinds);
+        }
+    }
+    for (auto const &[name, jumps] : branches) {
+        for (auto const &[ip, taken] : jumps) {
+            if (taken)
+                facts.branches[name].emplace(ip, *taken);
+        }
+    }
+    for (auto const &[name, frames] : frame_kinds) {
+        if (!std::ranges::all_of(frames, [](auto const &frame) {
+                return frame.second.has_value();
+            }))
+            continue;
+        auto &kinds = facts.frame_kinds[name];
+        for (auto const &[ip, frame] : frames) {
+            kinds.emplace(ip, *frame);
+        }
+    }
+    return facts;
 }
 
 checks::TypeChecker::TypeChecker(std::vector<traverser::Function> decls,
@@ -818,6 +1039,39 @@ struct FetchEffect : public checks::Effect {
     }
 };
 
+struct NthEffect : public checks::Effect {
+    virtual void operator()(checks::TypeChecker &,
+                            std::vector<checks::Type> &stack) override {
+        auto args = ensure(stack, {tstack({}), tint()}, "nth");
+        auto &stk = args.back();
+        stack.emplace_back(stk);
+        if (stk.kind == checks::Type::Stack)
+            if (auto &val = std::get<std::optional<std::vector<checks::Type>>>(
+                    stk.value)) {
+                if (val->empty())
+                    throw checks::CheckError("nth", "Got empty stack");
+                // The index is only known at runtime, so the element type is
+                // only known when every element agrees on it
+                std::optional<checks::Type> elem{};
+                for (auto type : *val) {
+                    while (type.kind == checks::Type::Many)
+                        type = *std::get<std::shared_ptr<checks::Type>>(
+                            type.value);
+                    if (!elem) {
+                        elem = type;
+                    } else if (!is_matching(type, *elem) ||
+                               !is_matching(*elem, type)) {
+                        stack.emplace_back(tliquid());
+                        return;
+                    }
+                }
+                stack.emplace_back(*elem);
+                return;
+            }
+        stack.emplace_back(tliquid());
+    }
+};
+
 struct ConcatEffect : public checks::Effect {
     virtual void operator()(checks::TypeChecker &,
                             std::vector<checks::Type> &stack) override {
@@ -1059,6 +1313,7 @@ static std::shared_ptr<checks::StaticEffect> const dpt_eff =
     std::make_shared<checks::StaticEffect>(
         checks::StaticEffect{{}, {tint()}, "dpt"});
 
+// The optimizer's view of these is in src/effects.cpp, keep both in step
 static std::unordered_map<std::string,
                           std::shared_ptr<checks::Effect>> const builtins{
     {"+", std::make_shared<ArithmEffect>(ArithmEffect{"+"})},
@@ -1148,6 +1403,7 @@ static std::unordered_map<std::string,
                  {tstack({}), tint()}, {tstack({})}, "drop"})},
     {"↘", std::make_shared<checks::StaticEffect>(
               checks::StaticEffect{{tstack({}), tint()}, {tstack({})}, "↘"})},
+    {"nth", std::make_shared<NthEffect>(NthEffect{})},
     {"rev", std::make_shared<RevEffect>(RevEffect{})},
     {"⇆", std::make_shared<RevEffect>(RevEffect{})},
     {"null", std::make_shared<NullEffect>(NullEffect{})},
@@ -7,6 +7,7 @@
 #include <memory>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace checks {
 struct CheckError {
@@ -38,6 +39,31 @@ struct Type {
     std::string show() const;
 };
 
+// What the checker proved about single instructions, for the backend to
+// specialize on. Keyed by function name, then instruction index.
+struct Facts {
+    // `box` calls only ever boxing values of this one scalar kind
+    std::unordered_map<std::string, std::unordered_map<size_t, Type::Kind>>
+        box_kinds{};
+    // Kinds of the whole frame before each reachable instruction, bottom
+    // first, for functions whose frame only ever holds scalars
+    std::unordered_map<std::string,
+                       std::unordered_map<size_t, std::vector<Type::Kind>>>
+        frame_kinds{};
+    // Kinds of both operands, bottom first, of operator calls that always
+    // see the same concrete pair
+    std::unordered_map<
+        std::string,
+        std::unordered_map<size_t, std::pair<Type::Kind, Type::Kind>>>
+        operand_kinds{};
+    // `?` branches, plain or fused, that every path reaching goes the same
+    // way, true when that is jumping
+    std::unordered_map<std::string, std::unordered_map<size_t, bool>>
+        branches{};
+    // Instructions no path reaches, labels included
+    std::unordered_map<std::string, std::unordered_set<size_t>> unreached{};
+};
+
 class TypeChecker;
 
 struct Effect {
@@ -65,14 +91,40 @@ class TypeChecker {
         expectations{};
     std::unordered_map<std::string, traverser::Function> decls{};
     std::vector<parser::TypeDecl> type_decls{};
+    // Body of the function being checked, facts are only collected on it
+    std::vector<ir::Instruction> const *checking{nullptr};
+    std::unordered_map<std::string,
+                       std::unordered_map<size_t, std::optional<Type::Kind>>>
+        box_kinds{};
+    std::unordered_map<
+        std::string,
+        std::unordered_map<size_t, std::optional<std::vector<Type::Kind>>>>
+        frame_kinds{};
+    std::unordered_map<
+        std::string,
+        std::unordered_map<size_t,
+                           std::optional<std::pair<Type::Kind, Type::Kind>>>>
+        operand_kinds{};
+    std::unordered_map<std::string,
+                       std::unordered_map<size_t, std::optional<bool>>>
+        branches{};
+    std::unordered_map<std::string, std::unordered_set<size_t>> reached{};
 
     void collect_signatures();
+    void note_box(std::string const &name, size_t ip,
+                  std::vector<Type> const &stack);
+    void note_frame(std::string const &name, size_t ip,
+                    std::vector<Type> const &stack);
+    void note_operands(std::string const &name, size_t ip,
+                       std::vector<Type> const &stack);
+    void note_branch(std::string const &name, size_t ip,
+                     std::optional<bool> taken);
 
   public:
     TypeChecker(std::vector<traverser::Function> decls, bool show_trace,
                 std::vector<parser::TypeDecl> type_decls);
 
-    void check();
+    Facts check();
 
     std::vector<std::vector<Type>>
     run_stack(std::vector<Type> from, std::string const &name,
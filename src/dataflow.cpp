@@ -0,0 +1,222 @@
+#include "dataflow.hpp"
+#include <algorithm>
+
+dataflow::Cfg dataflow::build_cfg(std::vector<ir::Instruction> const &irs) {
+    Cfg cfg{};
+    std::size_t begin = 0;
+    auto close = [&](std::size_t end) {
+        if (end > begin)
+            cfg.blocks.emplace_back(Block{begin, end});
+        begin = end;
+    };
+    for (std::size_t i = 0; i < irs.size(); ++i) {
+        switch (irs[i].kind) {
+        case ir::Instruction::Label:
+            close(i);
+            cfg.labels.emplace(std::get<std::string>(irs[i].value),
+                               cfg.blocks.size());
+            break;
+        case ir::Instruction::Goto:
+        case ir::Instruction::JumpTrue:
+        case ir::Instruction::JumpCompare:
+        case ir::Instruction::Exit:
+            close(i + 1);
+            break;
+        default:
+            break;
+        }
+    }
+    close(irs.size());
+    for (std::size_t b = 0; b < cfg.blocks.size(); ++b) {
+        auto &block = cfg.blocks[b];
+        auto const &last = irs[block.end - 1];
+        if (auto target = ir::jump_target(last);
+            target && cfg.labels.contains(*target)) {
+            block.successors.emplace_back(cfg.labels.at(*target));
+        }
+        if (last.kind != ir::Instruction::Goto &&
+            last.kind != ir::Instruction::Exit && b + 1 < cfg.blocks.size()) {
+            block.successors.emplace_back(b + 1);
+        }
+    }
+    cfg.reachable.resize(cfg.blocks.size(), false);
+    std::vector<std::size_t> pending{};
+    if (!cfg.blocks.empty())
+        pending.emplace_back(0);
+    while (!pending.empty()) {
+        std::size_t b = pending.back();
+        pending.pop_back();
+        if (cfg.reachable[b])
+            continue;
+        cfg.reachable[b] = true;
+        for (auto next : cfg.blocks[b].successors) {
+            pending.emplace_back(next);
+        }
+    }
+    return cfg;
+}
+
+std::optional<std::vector<std::optional<std::size_t>>>
+dataflow::depths(std::vector<ir::Instruction> const &irs, Cfg const &cfg,
+                 effects::Table const &functions, std::size_t start) {
+    std::vector<std::optional<std::size_t>> before(irs.size());
+    std::vector<std::optional<std::size_t>> entry(cfg.blocks.size());
+    std::vector<std::size_t> pending{};
+    if (!cfg.blocks.empty()) {
+        entry[0] = start;
+        pending.emplace_back(0);
+    }
+    while (!pending.empty()) {
+        auto const &block = cfg.blocks[pending.back()];
+        std::size_t depth = *entry[pending.back()];
+        pending.pop_back();
+        for (std::size_t i = block.begin; i < block.end; ++i) {
+            before[i] = depth;
+            std::size_t takes = 0, leaves = 0;
+            switch (irs[i].kind) {
+            case ir::Instruction::Label:
+            case ir::Instruction::Goto:
+            case ir::Instruction::Exit:
+                break;
+            case ir::Instruction::JumpTrue:
+                takes = 1;
+                break;
+            case ir::Instruction::JumpCompare:
+                // A fused literal is not on the stack
+                takes = std::get<std::vector<ir::Instruction>>(irs[i].value)
+                                    .size() == 3
+                            ? 1
+                            : 2;
+                break;
+            default: {
+                auto effect = effects::of(irs[i], functions);
+                if (!effect)
+                    return std::nullopt;
+                takes = effect->takes;
+                leaves = effect->leaves;
+            }
+            }
+            if (depth < takes)
+                return std::nullopt;
+            depth = depth - takes + leaves;
+        }
+        for (auto next : block.successors) {
+            if (!entry[next]) {
+                entry[next] = depth;
+                pending.emplace_back(next);
+            } else if (*entry[next] != depth) {
+                return std::nullopt;
+            }
+        }
+    }
+    return before;
+}
+
+// Liveness of the values on top of the stack, top last, and of all the
+// ones below them
+struct Slots {
+    std::vector<bool> top{};
+    bool below{false};
+
+    bool live(std::size_t depth) const {
+        return depth < top.size() ? top[top.size() - 1 - depth] : below;
+    }
+
+    void pop(std::size_t n) { top.resize(top.size() - std::min(n, top.size())); }
+
+    bool operator==(Slots const &) const = default;
+};
+
+static Slots join(Slots const &a, Slots const &b) {
+    Slots joined{{}, a.below || b.below};
+    std::size_t n = std::max(a.top.size(), b.top.size());
+    joined.top.resize(n);
+    for (std::size_t depth = 0; depth < n; ++depth) {
+        joined.top[n - 1 - depth] = a.live(depth) || b.live(depth);
+    }
+    return joined;
+}
+
+// Liveness before `instr` from the one after it, noting that of the values
+// it leaves in `outputs`
+static Slots transfer(ir::Instruction const &instr, Slots slots,
+                      effects::Table const &functions,
+                      std::vector<bool> &outputs) {
+    switch (instr.kind) {
+    case ir::Instruction::Label:
+    case ir::Instruction::Goto:
+        return slots;
+    case ir::Instruction::Exit:
+        return Slots{{}, true};
+    case ir::Instruction::JumpTrue:
+        slots.top.emplace_back(true);
+        return slots;
+    case ir::Instruction::JumpCompare: {
+        // A fused literal is not on the stack
+        auto const &parts = std::get<std::vector<ir::Instruction>>(instr.value);
+        slots.top.resize(slots.top.size() + (parts.size() == 3 ? 1 : 2), true);
+        return slots;
+    }
+    default:
+        break;
+    }
+    auto effect = effects::of(instr, functions);
+    if (!effect)
+        return Slots{{}, true};
+    outputs.resize(effect->leaves);
+    for (std::size_t depth = 0; depth < effect->leaves; ++depth) {
+        outputs[depth] = slots.live(depth);
+    }
+    slots.pop(effect->leaves);
+    bool used = std::ranges::any_of(outputs, [](bool live) { return live; });
+    // Bottom first like the stack
+    std::vector<bool> inputs(effect->takes, used || !effect->pure);
+    if (instr.kind == ir::Instruction::Call &&
+        ir::shuffles.contains(std::get<std::string>(instr.value))) {
+        auto const &leaves =
+            ir::shuffles.at(std::get<std::string>(instr.value)).leaves;
+        std::fill(inputs.begin(), inputs.end(), false);
+        for (std::size_t i = 0; i < leaves.size(); ++i) {
+            if (outputs[leaves.size() - 1 - i])
+                inputs[leaves[i]] = true;
+        }
+    }
+    slots.top.insert(slots.top.end(), inputs.begin(), inputs.end());
+    return slots;
+}
+
+// Rounds after which loops that keep growing the stack are given up on
+static constexpr std::size_t max_rounds = 64;
+
+std::vector<std::vector<bool>>
+dataflow::liveness(std::vector<ir::Instruction> const &irs, Cfg const &cfg,
+                   effects::Table const &functions) {
+    std::vector<std::vector<bool>> outputs(irs.size());
+    // Liveness when entering each block, nothing live until computed
+    std::vector<Slots> entry(cfg.blocks.size());
+    bool changed = true;
+    for (std::size_t round = 0; changed; ++round) {
+        if (round == max_rounds) {
+            for (auto &values : outputs) {
+                std::fill(values.begin(), values.end(), true);
+            }
+            break;
+        }
+        changed = false;
+        for (std::size_t b = cfg.blocks.size(); b-- > 0;) {
+            auto const &block = cfg.blocks[b];
+            Slots slots{{}, block.successors.empty()};
+            for (auto next : block.successors) {
+                slots = join(slots, entry[next]);
+            }
+            for (std::size_t i = block.end; i-- > block.begin;) {
+                slots = transfer(irs[i], slots, functions, outputs[i]);
+            }
+            if (slots != entry[b]) {
+                entry[b] = slots;
+                changed = true;
+            }
+        }
+    }
+    return outputs;
+}
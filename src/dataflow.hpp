@@ -0,0 +1,46 @@
+#pragma once
+
+#include "effects.hpp"
+#include "ir.hpp"
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dataflow {
+// Instructions `begin` to `end`, only entered at `begin` and only left
+// after `end - 1`
+struct Block {
+    std::size_t begin;
+    std::size_t end;
+    std::vector<std::size_t> successors{};
+};
+
+struct Cfg {
+    std::vector<Block> blocks{};
+    // Block each label starts
+    std::unordered_map<std::string, std::size_t> labels{};
+    // Whether each block can run, the first one being the entry
+    std::vector<bool> reachable{};
+};
+
+// Splits `irs` at labels and after jumps and exits
+Cfg build_cfg(std::vector<ir::Instruction> const &irs);
+
+// Values on the stack before each instruction, from `start` at the entry
+// and nothing for unreachable ones. Nothing at all when an instruction has
+// no known effect, takes more than there is, or paths join at different
+// depths
+std::optional<std::vector<std::optional<std::size_t>>>
+depths(std::vector<ir::Instruction> const &irs, Cfg const &cfg,
+       effects::Table const &functions, std::size_t start);
+
+// Whether each value left by each instruction is read later, top first. A
+// value is dead when every path pops it, directly or through pure
+// computations whose results are dead in turn. Values are live past
+// instructions of unknown effect and at exits
+std::vector<std::vector<bool>>
+liveness(std::vector<ir::Instruction> const &irs, Cfg const &cfg,
+         effects::Table const &functions);
+} // namespace dataflow
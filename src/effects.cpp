@@ -0,0 +1,116 @@
+#include "effects.hpp"
+
+// Every builtin the type checker knows, those of `ir::shuffles` aside. Ones
+// that may fail at runtime, on an empty stack, a bad index or a zero
+// divisor, are not pure
+static std::unordered_map<std::string, std::optional<effects::Effect>> const
+    builtins{
+        {"+", effects::Effect{2, 1, true}},
+        {"-", effects::Effect{2, 1, true}},
+        {"*", effects::Effect{2, 1, true}},
+        {"/", effects::Effect{2, 1, false}},
+        {"%", effects::Effect{2, 1, false}},
+        {"≡", std::nullopt},
+        {"dpt", std::nullopt},
+        {"flat", std::nullopt},
+        {"⬚", std::nullopt},
+        {"<", effects::Effect{2, 1, true}},
+        {">", effects::Effect{2, 1, true}},
+        {"<=", effects::Effect{2, 1, true}},
+        {">=", effects::Effect{2, 1, true}},
+        {"≤", effects::Effect{2, 1, true}},
+        {"≥", effects::Effect{2, 1, true}},
+        {"=", effects::Effect{2, 1, true}},
+        {"!=", effects::Effect{2, 1, true}},
+        {"≠", effects::Effect{2, 1, true}},
+        {"&&", effects::Effect{2, 1, true}},
+        {"∧", effects::Effect{2, 1, true}},
+        {"||", effects::Effect{2, 1, true}},
+        {"∨", effects::Effect{2, 1, true}},
+        {"!", effects::Effect{1, 1, true}},
+        {"¬", effects::Effect{1, 1, true}},
+        {"chr", effects::Effect{1, 1, false}},
+        {"ord", effects::Effect{1, 1, true}},
+        {"∈", effects::Effect{1, 2, true}},
+        {"type", effects::Effect{1, 2, true}},
+        {"int", effects::Effect{0, 1, true}},
+        {"float", effects::Effect{0, 1, true}},
+        {"char", effects::Effect{0, 1, true}},
+        {"bool", effects::Effect{0, 1, true}},
+        {"string", effects::Effect{0, 1, true}},
+        {"stack", effects::Effect{0, 1, true}},
+        {"box", std::nullopt},
+        {"▭", std::nullopt},
+        {"ins", effects::Effect{2, 1, true}},
+        {"⤓", effects::Effect{2, 1, true}},
+        {"fst", effects::Effect{1, 2, false}},
+        {"⊢", effects::Effect{1, 2, false}},
+        {"fst!", effects::Effect{1, 2, false}},
+        {"⊢!", effects::Effect{1, 2, false}},
+        {"lst", effects::Effect{1, 2, false}},
+        {"⊣", effects::Effect{1, 2, false}},
+        {"lst!", effects::Effect{1, 2, false}},
+        {"⊣!", effects::Effect{1, 2, false}},
+        {"++", effects::Effect{2, 1, true}},
+        {"⧺", effects::Effect{1, 2, true}},
+        {"len", effects::Effect{1, 2, true}},
+        {"take", effects::Effect{2, 2, false}},
+        {"↙", effects::Effect{2, 2, false}},
+        {"drop", effects::Effect{2, 1, false}},
+        {"↘", effects::Effect{2, 1, false}},
+        {"nth", effects::Effect{2, 2, false}},
+        {"rev", effects::Effect{1, 1, true}},
+        {"⇆", effects::Effect{1, 1, true}},
+        {"null", effects::Effect{1, 2, true}},
+        {"∘", effects::Effect{1, 2, true}},
+        {"str", effects::Effect{1, 1, true}},
+        {"slen", effects::Effect{1, 2, true}},
+        {"ℓ", effects::Effect{1, 2, true}},
+        {"@", effects::Effect{2, 2, false}},
+        {"@!", effects::Effect{3, 1, false}},
+        {"&", effects::Effect{2, 1, true}},
+        {".", effects::Effect{2, 1, true}},
+        {".!", effects::Effect{1, 2, false}},
+        {"▷", std::nullopt},
+        {"ap", std::nullopt},
+        {"⟜", std::nullopt},
+        {"tail", std::nullopt},
+        {"⋄", std::nullopt},
+        {"repeat", std::nullopt},
+        {"dbg", std::nullopt},
+        {"print", effects::Effect{1, 0, false}},
+    };
+
+std::optional<effects::Effect> effects::builtin(std::string const &name) {
+    if (ir::shuffles.contains(name)) {
+        auto const &shuffle = ir::shuffles.at(name);
+        return Effect{shuffle.takes, shuffle.leaves.size(), true};
+    }
+    if (builtins.contains(name))
+        return builtins.at(name);
+    return std::nullopt;
+}
+
+std::optional<effects::Effect> effects::of(ir::Instruction const &instr,
+                                           Table const &functions) {
+    switch (instr.kind) {
+    case ir::Instruction::PushInt:
+    case ir::Instruction::PushFloat:
+    case ir::Instruction::PushChar:
+    case ir::Instruction::PushStr:
+    case ir::Instruction::PushBool:
+    case ir::Instruction::PushStack:
+    case ir::Instruction::Subroutine:
+        return Effect{0, 1, true};
+    case ir::Instruction::Call: {
+        auto const &name = std::get<std::string>(instr.value);
+        if (ir::shuffles.contains(name) || builtins.contains(name))
+            return builtin(name);
+        if (functions.contains(name))
+            return functions.at(name);
+        return std::nullopt;
+    }
+    default:
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ir.hpp"
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace effects {
+// What an instruction does to the values on top of the stack
+struct Effect {
+    std::size_t takes;
+    std::size_t leaves;
+    // Only computes what it leaves from what it takes: it cannot fail, has
+    // no side effect and reads nothing else, so it can go with its results.
+    // Operands of the wrong kind would make most builtins fail, so this only
+    // holds of programs the checker accepted
+    bool pure;
+};
+
+// Effects of the program's functions with fixed arities, by name
+using Table = std::unordered_map<std::string, Effect>;
+
+// Effect of the builtin `name`, nothing for the ones that reach the whole
+// stack or call functions, and for names that are not builtins
+std::optional<Effect> builtin(std::string const &name);
+
+// Effect of a straight-line instruction, nothing for control flow and calls
+// of unknown effect
+std::optional<Effect> of(ir::Instruction const &instr,
+                         Table const &functions);
+} // namespace effects
@@ -0,0 +1,352 @@
+#include "evaluate.hpp"
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Values are the literal pushes that leave them, stacks as `PushStack` and
+// functions as the `Subroutine` itself. A frame holds them bottom first
+using Value = ir::Instruction;
+using Frame = std::vector<Value>;
+
+bool evaluate::is_value(ir::Instruction const &instr) {
+    switch (instr.kind) {
+    case ir::Instruction::PushInt:
+    case ir::Instruction::PushFloat:
+    case ir::Instruction::PushChar:
+    case ir::Instruction::PushStr:
+    case ir::Instruction::PushBool:
+    case ir::Instruction::PushStack:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static std::size_t size(Value const &value) {
+    if (value.kind == ir::Instruction::PushStr)
+        return 1 + std::get<std::string>(value.value).size() / 8;
+    if (value.kind != ir::Instruction::PushStack)
+        return 1;
+    std::size_t total = 1;
+    for (auto const &elem : std::get<std::vector<Value>>(value.value)) {
+        total += size(elem);
+    }
+    return total;
+}
+
+static std::size_t size(Frame const &frame) {
+    std::size_t total = 0;
+    for (auto const &value : frame) {
+        total += size(value);
+    }
+    return total;
+}
+
+// Whether `value` can be left in the program, having no function in it
+static bool is_emittable(Value const &value) {
+    switch (value.kind) {
+    case ir::Instruction::PushStack:
+        return std::ranges::all_of(std::get<std::vector<Value>>(value.value),
+                                   is_emittable);
+    default:
+        return evaluate::is_value(value);
+    }
+}
+
+static std::vector<Value> *stack_of(Value &value) {
+    if (value.kind != ir::Instruction::PushStack)
+        return nullptr;
+    return &std::get<std::vector<Value>>(value.value);
+}
+
+// Builtins that only compute on the frame, run as the runtime does. Each
+// gives up, returning false, where the runtime would fail
+static std::unordered_map<std::string, bool (*)(Frame &)> const builtins{
+    {"¬",
+     [](Frame &frame) {
+         if (frame.empty() || frame.back().kind != ir::Instruction::PushBool)
+             return false;
+         frame.back().value = !std::get<bool>(frame.back().value);
+         return true;
+     }},
+    {"▭",
+     [](Frame &frame) {
+         // Element 0 is the top
+         std::vector<Value> elems{frame.rbegin(), frame.rend()};
+         frame.clear();
+         frame.emplace_back(Value{ir::Instruction::PushStack, elems});
+         return true;
+     }},
+    {"≡",
+     [](Frame &frame) {
+         frame.emplace_back(
+             Value{ir::Instruction::PushInt, static_cast<int>(frame.size())});
+         return true;
+     }},
+    {"len",
+     [](Frame &frame) {
+         if (frame.empty() || !stack_of(frame.back()))
+             return false;
+         int len = static_cast<int>(stack_of(frame.back())->size());
+         frame.emplace_back(Value{ir::Instruction::PushInt, len});
+         return true;
+     }},
+    {"⊢",
+     [](Frame &frame) {
+         auto stk = frame.empty() ? nullptr : stack_of(frame.back());
+         if (!stk || stk->empty())
+             return false;
+         frame.emplace_back(stk->front());
+         return true;
+     }},
+    {"⊣",
+     [](Frame &frame) {
+         auto stk = frame.empty() ? nullptr : stack_of(frame.back());
+         if (!stk || stk->empty())
+             return false;
+         frame.emplace_back(stk->back());
+         return true;
+     }},
+    {"⊢!",
+     [](Frame &frame) {
+         auto stk = frame.empty() ? nullptr : stack_of(frame.back());
+         if (!stk || stk->empty())
+             return false;
+         auto elem = stk->front();
+         stk->erase(stk->begin());
+         frame.emplace_back(std::move(elem));
+         return true;
+     }},
+    {"⊣!",
+     [](Frame &frame) {
+         auto stk = frame.empty() ? nullptr : stack_of(frame.back());
+         if (!stk || stk->empty())
+             return false;
+         auto elem = stk->back();
+         stk->pop_back();
+         frame.emplace_back(std::move(elem));
+         return true;
+     }},
+    {"ins",
+     [](Frame &frame) {
+         if (frame.size() < 2 || !stack_of(frame.end()[-2]))
+             return false;
+         auto elem = frame.back();
+         frame.pop_back();
+         auto stk = stack_of(frame.back());
+         stk->insert(stk->begin(), std::move(elem));
+         return true;
+     }},
+    {"⇆",
+     [](Frame &frame) {
+         if (frame.empty() || !stack_of(frame.back()))
+             return false;
+         std::ranges::reverse(*stack_of(frame.back()));
+         return true;
+     }},
+    {"&",
+     [](Frame &frame) {
+         if (frame.size() < 2 ||
+             frame.back().kind != ir::Instruction::PushStr ||
+             frame.end()[-2].kind != ir::Instruction::PushStr)
+             return false;
+         auto tail = std::get<std::string>(frame.back().value);
+         frame.pop_back();
+         std::get<std::string>(frame.back().value) += tail;
+         return true;
+     }},
+    {"ord",
+     [](Frame &frame) {
+         if (frame.empty() || frame.back().kind != ir::Instruction::PushChar)
+             return false;
+         frame.back() = Value{
+             ir::Instruction::PushInt,
+             static_cast<int>(std::get<char32_t>(frame.back().value))};
+         return true;
+     }},
+};
+
+// Other names of the builtins above
+static std::unordered_map<std::string, std::string> const aliases{
+    {"!", "¬"},    {"box", "▭"},   {"dpt", "≡"},   {"fst", "⊢"},
+    {"lst", "⊣"},  {"fst!", "⊢!"}, {"lst!", "⊣!"}, {"⤓", "ins"},
+    {"rev", "⇆"},
+};
+
+// Builtins on two values `passes::fold` computes
+static std::unordered_set<std::string> const folded{
+    "+", "-", "*",  "/",  "%",  "<", ">",  "<=", ">=", "≤",
+    "≥", "=", "!=", "≠", "∧", "&&", "∨", "||"};
+
+// Calls nested deeper than this give up
+constexpr std::size_t depth_limit = 64;
+
+namespace {
+struct Machine {
+    passes::Callees const &callees;
+    std::size_t steps{0};
+    std::size_t depth{0};
+
+    // Runs `body` on `frame` up to its exit, false to give up
+    bool run(std::vector<ir::Instruction> const &body, Frame &frame) {
+        std::unordered_map<std::string, std::size_t> targets{};
+        for (std::size_t i = 0; i < body.size(); ++i) {
+            if (body[i].kind == ir::Instruction::Label)
+                targets.emplace(std::get<std::string>(body[i].value), i);
+        }
+        // Pops the bool on top and goes to `label` or the next instruction
+        auto branch = [&](std::size_t &ip, std::string const &label) {
+            if (frame.empty() || frame.back().kind != ir::Instruction::PushBool)
+                return false;
+            bool jumps = std::get<bool>(frame.back().value);
+            frame.pop_back();
+            ip = jumps ? targets.at(label) : ip + 1;
+            return true;
+        };
+        std::size_t ip = 0;
+        while (ip < body.size()) {
+            if (++steps > evaluate::step_limit ||
+                size(frame) > evaluate::size_limit)
+                return false;
+            auto const &instr = body[ip];
+            switch (instr.kind) {
+            case ir::Instruction::Call:
+                if (!apply(std::get<std::string>(instr.value), frame))
+                    return false;
+                ++ip;
+                break;
+            case ir::Instruction::JumpTrue:
+                if (!branch(ip, std::get<std::string>(instr.value)))
+                    return false;
+                break;
+            case ir::Instruction::JumpCompare: {
+                auto const &parts =
+                    std::get<std::vector<ir::Instruction>>(instr.value);
+                for (auto const &part : parts) {
+                    if (part.kind == ir::Instruction::Call &&
+                        !apply(std::get<std::string>(part.value), frame))
+                        return false;
+                    if (evaluate::is_value(part))
+                        frame.emplace_back(part);
+                }
+                if (!branch(ip, std::get<std::string>(parts.back().value)))
+                    return false;
+                break;
+            }
+            case ir::Instruction::Goto:
+                ip = targets.at(std::get<std::string>(instr.value));
+                break;
+            case ir::Instruction::Label:
+                ++ip;
+                break;
+            case ir::Instruction::Exit:
+                return true;
+            case ir::Instruction::Subroutine:
+                frame.emplace_back(instr);
+                ++ip;
+                break;
+            default:
+                if (!evaluate::is_value(instr))
+                    return false;
+                frame.emplace_back(instr);
+                ++ip;
+                break;
+            }
+        }
+        return true;
+    }
+
+    // Runs the function value on top of `frame`, which it shares
+    bool apply_routine(Frame &frame) {
+        if (frame.empty() || frame.back().kind != ir::Instruction::Subroutine)
+            return false;
+        auto routine = std::get<std::vector<ir::Instruction>>(
+            std::move(frame.back().value));
+        frame.pop_back();
+        return run(routine, frame);
+    }
+
+    bool apply(std::string const &name, Frame &frame) {
+        if (auto shuffle = ir::shuffles.find(name);
+            shuffle != ir::shuffles.end()) {
+            auto const &[takes, leaves] = shuffle->second;
+            if (frame.size() < takes)
+                return false;
+            Frame taken{frame.end() - takes, frame.end()};
+            frame.resize(frame.size() - takes);
+            for (auto i : leaves) {
+                frame.emplace_back(taken[i]);
+            }
+            return true;
+        }
+        if (folded.contains(name)) {
+            if (frame.size() < 2)
+                return false;
+            auto result = passes::fold(name, frame.end()[-2], frame.back());
+            if (!result)
+                return false;
+            frame.resize(frame.size() - 2);
+            frame.emplace_back(std::move(*result));
+            return true;
+        }
+        auto builtin = builtins.find(aliases.contains(name) ? aliases.at(name)
+                                                            : name);
+        if (builtin != builtins.end())
+            return builtin->second(frame);
+        if (name == "▷" || name == "ap")
+            return apply_routine(frame);
+        if (name == "⟜" || name == "tail") {
+            if (frame.size() < 2)
+                return false;
+            auto kept = frame.end()[-2];
+            frame.erase(frame.end() - 2);
+            if (!apply_routine(frame))
+                return false;
+            frame.emplace_back(std::move(kept));
+            return true;
+        }
+        if (name == "⋄" || name == "repeat") {
+            if (frame.size() < 2 ||
+                frame.back().kind != ir::Instruction::PushInt ||
+                frame.end()[-2].kind != ir::Instruction::Subroutine)
+                return false;
+            int count = std::get<int>(frame.back().value);
+            frame.pop_back();
+            auto routine = std::get<std::vector<ir::Instruction>>(
+                std::move(frame.back().value));
+            frame.pop_back();
+            for (int i = 0; i < count; ++i) {
+                if (!run(routine, frame))
+                    return false;
+            }
+            return true;
+        }
+        if (!callees.contains(name) || depth >= depth_limit)
+            return false;
+        auto const &callee = callees.at(name);
+        if (frame.size() < callee.args)
+            return false;
+        Frame inner{frame.end() - callee.args, frame.end()};
+        frame.resize(frame.size() - callee.args);
+        ++depth;
+        bool done = run(*callee.body, inner);
+        --depth;
+        // Leaving the frame keeps only the returns
+        if (!done || inner.size() < callee.rets)
+            return false;
+        frame.insert(frame.end(), inner.end() - callee.rets, inner.end());
+        return true;
+    }
+};
+} // namespace
+
+std::optional<std::vector<ir::Instruction>>
+evaluate::call(std::string const &name, std::vector<ir::Instruction> args,
+               passes::Callees const &callees) {
+    Machine machine{callees};
+    if (!machine.apply(name, args) || size(args) > size_limit ||
+        !std::ranges::all_of(args, is_emittable))
+        return std::nullopt;
+    return args;
+}
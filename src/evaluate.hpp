@@ -0,0 +1,27 @@
+#pragma once
+
+#include "ir.hpp"
+#include "passes.hpp"
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace evaluate {
+// Instructions one evaluation may run before it gives up
+constexpr std::size_t step_limit = 100000;
+// Values, counting those in stacks and a string's bytes by eights, that one
+// frame may grow to, shuffled copies included
+constexpr std::size_t size_limit = 256;
+
+// Whether `instr` pushes a value known at compile time
+bool is_value(ir::Instruction const &instr);
+
+// Runs the function `name` of `callees` on the pushed values `args`, bottom
+// first, for the values it returns, bottom first. Only computation is run:
+// nothing when it reaches a builtin not known to be free of effects, a
+// foreign function or a failure, or goes over the budgets
+std::optional<std::vector<ir::Instruction>>
+call(std::string const &name, std::vector<ir::Instruction> args,
+     passes::Callees const &callees);
+} // namespace evaluate
@@ -16,10 +16,26 @@ std::string ir::Instruction::show() {
     }
     case PushBool:
         return "Push " + std::string(std::get<bool>(value) ? "⊤" : "⊥");
+    case PushStack: {
+        std::string elems{};
+        for (auto &elem : std::get<std::vector<Instruction>>(value)) {
+            // Without the "Push " of each element
+            elems += (elems.empty() ? "" : ", ") + elem.show().substr(5);
+        }
+        return std::format("Push [{}]", elems);
+    }
     case Call:
         return "Call " + std::get<std::string>(value);
     case JumpTrue:
         return "JumpTrue " + std::get<std::string>(value);
+    case JumpCompare: {
+        auto parts = std::get<std::vector<Instruction>>(value);
+        std::string instrs{parts.front().show()};
+        for (auto part = parts.begin() + 1; part != parts.end(); ++part) {
+            instrs += ", " + part->show();
+        }
+        return std::format("JumpCompare [{}]", instrs);
+    }
     case Goto:
         return "Goto " + std::get<std::string>(value);
     case Label:
@@ -48,3 +64,33 @@ std::string ir::Instruction::show() {
     }
     }
 }
+
+std::unordered_map<std::string, ir::Shuffle> const ir::shuffles{
+    {"dup", {1, {0, 0}}},     {"⇈", {1, {0, 0}}},
+    {"swp", {2, {1, 0}}},     {"↕", {2, {1, 0}}},
+    {"ovr", {2, {0, 1, 0}}},  {"⊼", {2, {0, 1, 0}}},
+    {"pck", {3, {0, 1, 2, 0}}}, {"⩞", {3, {0, 1, 2, 0}}},
+    {"nip", {2, {1}}},        {"⦵", {2, {1}}},
+    {"swpd", {3, {1, 0, 2}}}, {"↨", {3, {1, 0, 2}}},
+    {"tck", {2, {1, 0, 1}}},  {"⊻", {2, {1, 0, 1}}},
+    {"rot", {3, {1, 2, 0}}},  {"↻", {3, {1, 2, 0}}},
+    {"rot-", {3, {2, 0, 1}}}, {"↷", {3, {2, 0, 1}}},
+    {"pop", {1, {}}},         {"◌", {1, {}}},
+};
+
+std::string *ir::jump_target(Instruction &instr) {
+    switch (instr.kind) {
+    case Instruction::Goto:
+    case Instruction::JumpTrue:
+        return &std::get<std::string>(instr.value);
+    case Instruction::JumpCompare:
+        return &std::get<std::string>(
+            std::get<std::vector<Instruction>>(instr.value).back().value);
+    default:
+        return nullptr;
+    }
+}
+
+std::string const *ir::jump_target(Instruction const &instr) {
+    return jump_target(const_cast<Instruction &>(instr));
+}
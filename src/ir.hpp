@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <string>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -19,8 +20,13 @@ struct Instruction {
         PushChar,
         PushStr,
         PushBool,
+        // A stack of literal pushes, element 0 the top
+        PushStack,
         Call,
         JumpTrue,
+        // `[literal push] comparison JumpTrue` as one branch, see
+        // `passes::fuse_compare_branches`
+        JumpCompare,
         Goto,
         Label,
         Exit,
@@ -35,4 +41,17 @@ struct Instruction {
 
     std::string show();
 };
+
+// Builtins that only reorder or copy their top `takes` values, `leaves`
+// indexes the taken values bottom first
+struct Shuffle {
+    std::size_t takes;
+    std::vector<std::size_t> leaves;
+};
+
+extern std::unordered_map<std::string, Shuffle> const shuffles;
+
+// Label a jump goes to, nothing for other instructions
+std::string *jump_target(Instruction &instr);
+std::string const *jump_target(Instruction const &instr);
 } // namespace ir
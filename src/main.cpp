@@ -24,7 +24,9 @@ int main(int argc, char *argv[]) {
         std::println("  -dry");
         std::println("  * Does a dry-run, doesn't output binary\nStill outputs C file");
         std::println("  -cfile <c-file-path>");
-        std::println("  * Outputs generated C code instead of passing through STDIN");
+        std::println("  * Outputs generated C code instead of passing through STDIN\n");
+        std::println("  -O0 | -O1 | -O2");
+        std::println("  * Sets how much the IR is optimized, -O1 by default");
         return 1;
     }
     std::filesystem::path exe_dir{
@@ -50,6 +52,8 @@ int main(int argc, char *argv[]) {
             b.type();
         } else if (arg == "-dry") {
             b.dry();
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            b.optimize(arg[2] - '0');
         } else if (arg == "-o") {
             ++i;
             if (i >= argc) {
@@ -1,13 +1,20 @@
 #include "make_c.hpp"
+#include "evaluate.hpp"
 #include "ir.hpp"
 #include "mangler.hpp"
 #include "parser.hpp"
 #include "traverser.hpp"
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cmath>
 #include <functional>
 #include <print>
 #include <ranges>
+#include <set>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 
 std::string intercalate(std::vector<std::string> list, std::string delim) {
     if (list.empty()) {
@@ -32,11 +39,6 @@ std::string name_of(parser::TypeSig type) {
     return res;
 }
 
-std::string get_temp() {
-    static std::size_t temp_counter = 0;
-    return "__itemp" + std::to_string(temp_counter++);
-}
-
 std::string process_returns(traverser::Function const &fn,
                             std::string const &defers) {
     std::istringstream in(std::get<std::string>(fn.body));
@@ -50,7 +52,8 @@ std::string process_returns(traverser::Function const &fn,
             line.compare(first, match.size(), match) == 0 &&
             line.find_first_not_of(" \t", first + match.size()) ==
                 std::string::npos) {
-            out += defers + "\nreturn __istack;\n";
+            out += defers + "\n{\nch_stack_from_deque(__ifull, __istack);\n"
+                            "return;\n}\n";
         } else {
             out += line + '\n';
         }
@@ -73,7 +76,7 @@ std::string process_mangling(std::string const &body) {
             break;
 
         std::string name = mangled.substr(open + 2, close - (open + 2));
-        std::string replacement = mangle(name);
+        std::string replacement = "__ibox" + mangle(name);
 
         mangled.replace(open, (close + 2) - open, replacement);
 
@@ -83,12 +86,53 @@ std::string process_mangling(std::string const &body) {
     return mangled;
 }
 
+std::set<std::string> box_calls(std::string const &body) {
+    std::set<std::string> names{};
+
+    std::size_t pos = 0;
+    while (true) {
+        std::size_t open = body.find("@(", pos);
+        if (open == std::string::npos)
+            break;
+
+        std::size_t close = body.find(")@", open + 2);
+        if (close == std::string::npos)
+            break;
+
+        names.emplace(body.substr(open + 2, close - (open + 2)));
+        pos = close + 2;
+    }
+
+    return names;
+}
+
+// cffi bodies see Charta functions through the boxed stack API, the call
+// runs on its own stack built from `*__ifull` and returns all of it
+void emit_box_call(std::string const &name, std::string &out) {
+    std::string mangled{mangle(name)};
+    out += "static ch_deque *__ibox" + mangled + "(ch_deque **__ifull) {\n";
+    out += "ch_stack __istack = ch_stack_new();\n";
+    out += "if (__ifull) {\n";
+    out += "ch_stack_from_deque(&__istack, *__ifull);\n";
+    out += "*__ifull = NULL;\n";
+    out += "}\n";
+    out += "CH_CALL(" + mangled + ", &__istack);\n";
+    out += "ch_deque *__iout = ch_stack_to_deque(&__istack);\n";
+    out += "ch_stack_delete(&__istack);\n";
+    out += "return __iout;\n";
+    out += "}\n";
+}
+
 void emit_foreign(traverser::Function fn, std::string &out) {
+    out += "ch_deque *__istack = ch_stack_pop_args(__ifull, " +
+           std::to_string(fn.args.args.size()) + ", " +
+           std::to_string(fn.args.kind == parser::Argument::Ellipses) +
+           ");\n";
     std::string defers{};
     for (auto &[name, type] : fn.args.args) {
         if (type.name == "stack" || type.is_stack) {
-            out += "ch_stack_node *" + name +
-                   "=ch_stk_pop(&__istack).value.stk;\n";
+            out += "ch_deque *" + name + "=ch_stk_pop(&__istack).value.stk;\n";
+            out += "ch_stk_unpack(&" + name + ");\n";
             defers += "ch_stk_delete(&" + name + ");\n";
         } else if (type.name == "int") {
             out += "int " + name + "=ch_stk_pop(&__istack).value.i;\n";
@@ -99,10 +143,12 @@ void emit_foreign(traverser::Function fn, std::string &out) {
         } else if (type.name == "bool") {
             out += "char " + name + "=ch_stk_pop(&__istack).value.b;\n";
         } else if (type.name == "function") {
-            out += "ch_stack_node *(*" + name +
-                   ")(ch_stack_node **) =ch_stk_pop(&__istack).value.fn;\n";
+            out += "void (*" + name +
+                   ")(ch_stack *) =ch_stk_pop(&__istack).value.fn;\n";
         } else if (type.name == "string") {
-            out += "ch_string " + name + "=ch_stk_pop(&__istack).value.s;\n";
+            out += "ch_string " + name +
+                   "=ch_valas_string(ch_stk_pop(&__istack));\n";
+            out += "ch_str_heap(&" + name + ");\n";
             defers += "ch_str_delete(&" + name + ");\n";
         } else if (type.name == "opaque") {
             out += "void *" + name + "=ch_stk_pop(&__istack).value.op;\n";
@@ -116,20 +162,17 @@ void emit_foreign(traverser::Function fn, std::string &out) {
 void emit_type(parser::TypeDecl decl, std::string &out) {
     std::string mangled{mangle(decl.name)};
     std::string type{"__it" + mangled};
-    out += "ch_stack_node *" + mangled + "(ch_stack_node **__ifull) {\n";
-    out += "ch_stack_node *__istack=ch_stk_args(__ifull, 0, 0);\n";
-    out += "ch_stk_push(&__istack, ch_valof_int(__iti" + mangled + "));\n";
-    out += "return __istack;\n";
+    out += "void " + mangled + "(ch_stack *__istack) {\n";
+    out += "ch_stack_push(__istack, ch_valof_int(__iti" + mangled + "));\n";
     out += "}\n";
 
-    out += "ch_stack_node *" + mangle(decl.name + "!") +
-           "(ch_stack_node **__ifull) {\n";
-    out += "ch_stack_node *__istack=ch_stk_args(__ifull, " +
-           std::to_string(decl.body.size()) + ",0);\n";
+    out += "void " + mangle(decl.name + "!") + "(ch_stack *__istack) {\n";
+    out += "ch_stack_need(__istack, " + std::to_string(decl.body.size()) +
+           ");\n";
     out +=
         "struct " + type + "* __istruct=malloc(sizeof(struct " + type + "));\n";
     for (auto &[name, sig] : decl.body) {
-        out += "__istruct->" + mangle(name) + "=ch_stk_pop(&__istack);\n";
+        out += "__istruct->" + mangle(name) + "=ch_stack_pop(__istack);\n";
         if (sig.name == "stack" || sig.is_stack) {
             out +=
                 "if (__istruct->" + mangle(name) + ".kind!=CH_VALK_STACK) {\n";
@@ -203,9 +246,8 @@ void emit_type(parser::TypeDecl decl, std::string &out) {
             out += "}\n";
         }
     }
-    out += "ch_stk_push(&__istack,(ch_value){.kind=__iti" + mangled +
+    out += "ch_stack_push(__istack,(ch_value){.kind=__iti" + mangled +
            ",.value.op=__istruct});\n";
-    out += "return __istack;\n";
     out += "}\n";
 
     out += "void __idelete" + mangled + "(void *obj) {\n";
@@ -227,27 +269,26 @@ void emit_type(parser::TypeDecl decl, std::string &out) {
     out += "}\n";
 
     for (auto &[name, sig] : decl.body) {
-        out += "ch_stack_node *" + mangle(decl.name + "." + name) +
-               "(ch_stack_node **__ifull) {\n";
-        out += "ch_stack_node *__istack=ch_stk_args(__ifull, 1, 0);\n";
-        out += "ch_value v=ch_stk_pop(&__istack);\n";
+        out += "void " + mangle(decl.name + "." + name) +
+               "(ch_stack *__istack) {\n";
+        out += "ch_stack_need(__istack, 1);\n";
+        out += "ch_value v=ch_stack_pop(__istack);\n";
         out += "if (v.kind != __iti" + mangled + ") {\n";
         out += "printf(\"ERR: '" + decl.name + "." + name + "' expected '" +
                decl.name + "', got '%s'\\n\", ch_valk_name(v.kind));\n";
         out += "exit(1);\n";
         out += "}\n";
         out += "struct __it" + mangled + "* st=v.value.op;\n";
-        out += "ch_stk_push(&__istack, v);\n";
+        out += "ch_stack_push(__istack, v);\n";
         out +=
-            "ch_stk_push(&__istack, ch_valcpy(&st->" + mangle(name) + "));\n";
-        out += "return __istack;\n";
+            "ch_stack_push(__istack, ch_valcpy(&st->" + mangle(name) + "));\n";
         out += "}\n";
 
-        out += "ch_stack_node *" + mangle(decl.name + "." + name + "!") +
-               "(ch_stack_node **__ifull) {\n";
-        out += "ch_stack_node *__istack=ch_stk_args(__ifull, 2, 0);\n";
-        out += "ch_value new=ch_stk_pop(&__istack);\n";
-        out += "ch_value v=ch_stk_pop(&__istack);\n";
+        out += "void " + mangle(decl.name + "." + name + "!") +
+               "(ch_stack *__istack) {\n";
+        out += "ch_stack_need(__istack, 2);\n";
+        out += "ch_value new=ch_stack_pop(__istack);\n";
+        out += "ch_value v=ch_stack_pop(__istack);\n";
         out += "if (v.kind != __iti" + mangled + ") {\n";
         out += "printf(\"ERR: '" + decl.name + "." + name + "!' expected '" +
                decl.name + "', got '%s'\\n\", ch_valk_name(v.kind));\n";
@@ -295,76 +336,607 @@ void emit_type(parser::TypeDecl decl, std::string &out) {
         out += "struct __it" + mangled + "* st=v.value.op;\n";
         out += "ch_val_delete(&st->" + mangle(name) + ");\n";
         out += "st->" + mangle(name) + "=new;\n";
-        out += "ch_stk_push(&__istack, v);\n";
-        out += "return __istack;\n";
+        out += "ch_stack_push(__istack, v);\n";
         out += "}\n";
     }
 }
 
+std::string value_kind(checks::Type::Kind kind) {
+    switch (kind) {
+    case checks::Type::Int:
+        return "CH_VALK_INT";
+    case checks::Type::Float:
+        return "CH_VALK_FLOAT";
+    case checks::Type::Char:
+        return "CH_VALK_CHAR";
+    case checks::Type::Bool:
+        return "CH_VALK_BOOL";
+    default:
+        assert(false && "Not a scalar kind");
+        return "";
+    }
+}
+
+using BoxKinds = std::unordered_map<std::size_t, checks::Type::Kind>;
+using Operands = std::unordered_map<std::size_t,
+                                    std::pair<checks::Type::Kind, checks::Type::Kind>>;
+using Branches = std::unordered_map<std::size_t, bool>;
+using Unreached = std::unordered_set<std::size_t>;
+
+std::unordered_map<std::string, std::string> const numeric_entries{
+    {"+", "add"}, {"-", "sub"}, {"*", "mul"}, {"/", "div"},
+    {"<", "lt"},  {">", "gt"},  {"<=", "le"}, {"≤", "le"},
+    {">=", "ge"}, {"≥", "ge"}};
+
+std::unordered_map<std::string, std::string> const equal_entries{
+    {"=", "eq"}, {"!=", "ne"}, {"≠", "ne"}};
+
+// Runtime entry point of `callee` specialized to its operand kinds
+std::optional<std::string>
+typed_entry(std::string const &callee,
+            std::pair<checks::Type::Kind, checks::Type::Kind> kinds) {
+    auto suffix = [](checks::Type::Kind kind) -> std::optional<std::string> {
+        switch (kind) {
+        case checks::Type::Int:
+            return "i";
+        case checks::Type::Float:
+            return "f";
+        case checks::Type::Char:
+            return "c";
+        case checks::Type::Bool:
+            return "b";
+        case checks::Type::String:
+            return "s";
+        default:
+            return std::nullopt;
+        }
+    };
+    auto [under, top] = kinds;
+    auto a = suffix(under), b = suffix(top);
+    if (!a || !b)
+        return std::nullopt;
+    bool numeric = (*a == "i" || *a == "f") && (*b == "i" || *b == "f");
+    if (numeric_entries.contains(callee) && numeric)
+        return "ch_" + numeric_entries.at(callee) + "_" + *a + *b;
+    if (callee == "%" && *a == "i" && *b == "i")
+        return "ch_mod_ii";
+    if (equal_entries.contains(callee) && under == top)
+        return "ch_" + equal_entries.at(callee) + "_" + *a + *b;
+    return std::nullopt;
+}
+
+std::string slot_field(checks::Type::Kind kind) {
+    switch (kind) {
+    case checks::Type::Float:
+        return ".value.f";
+    case checks::Type::Bool:
+        return ".value.b";
+    default:
+        return ".value.i";
+    }
+}
+
+bool is_number(checks::Type::Kind kind) {
+    return kind == checks::Type::Int || kind == checks::Type::Float;
+}
+
+bool is_scalar(checks::Type::Kind kind) {
+    return is_number(kind) || kind == checks::Type::Char ||
+           kind == checks::Type::Bool;
+}
+
+// C expression of exactly the float `f`, hexadecimal so no digit is lost
+std::string float_literal(float f) {
+    if (std::isnan(f))
+        return "NAN";
+    if (std::isinf(f))
+        return f < 0 ? "(-INFINITY)" : "INFINITY";
+    char digits[32];
+    auto end = std::to_chars(digits, digits + sizeof(digits), std::fabs(f),
+                             std::chars_format::hex)
+                   .ptr;
+    std::string literal{"0x" + std::string(digits, end) + "f"};
+    return std::signbit(f) ? "(-" + literal + ")" : literal;
+}
+
+// Kind and C value of a scalar literal push
+std::pair<checks::Type::Kind, std::string>
+scalar_literal(ir::Instruction const &ir) {
+    switch (ir.kind) {
+    case ir::Instruction::PushInt:
+        return {checks::Type::Int, std::to_string(std::get<int>(ir.value))};
+    case ir::Instruction::PushFloat:
+        return {checks::Type::Float, float_literal(std::get<float>(ir.value))};
+    case ir::Instruction::PushChar:
+        return {checks::Type::Char,
+                std::to_string(std::get<char32_t>(ir.value))};
+    case ir::Instruction::PushBool:
+        return {checks::Type::Bool, std::to_string(std::get<bool>(ir.value))};
+    default:
+        assert(false && "Not a scalar literal");
+        return {};
+    }
+}
+
+// `ch_value` of a scalar literal push
+std::string boxed_literal(ir::Instruction const &ir) {
+    switch (ir.kind) {
+    case ir::Instruction::PushInt:
+        return "ch_valof_int(" + std::to_string(std::get<int>(ir.value)) + ")";
+    case ir::Instruction::PushFloat:
+        return "ch_valof_float(" + float_literal(std::get<float>(ir.value)) +
+               ")";
+    case ir::Instruction::PushChar:
+        return "ch_valof_char(" +
+               std::to_string(std::get<char32_t>(ir.value)) + ")";
+    case ir::Instruction::PushBool:
+        return "ch_valof_bool(" + std::to_string(std::get<bool>(ir.value)) +
+               ")";
+    default:
+        assert(false && "Not a scalar literal");
+        return {};
+    }
+}
+
+// Literal strings and stacks of the program, held by globals that live as
+// long as it does. Strings are static read-only data and pushing one only
+// stores a pointer to it. Stacks are built once before `main` runs and
+// pushing one only counts a reference to the same deque. Either is copied
+// by the first builtin writing to it
+struct Constants {
+    // Declarations of the globals holding them, and the code building the
+    // stacks
+    std::string decls{};
+    std::string init{};
+    // Global of each stack by the code building it
+    std::unordered_map<std::string, std::string> names{};
+    // Global of each string by its contents
+    std::unordered_map<std::string, std::string> strings{};
+
+    // `ch_value` pushed by the literal push `ir`
+    std::string value(ir::Instruction const &ir) {
+        switch (ir.kind) {
+        case ir::Instruction::PushStr:
+            return "ch_valof_literal(&" +
+                   string(std::get<std::string>(ir.value)) + ")";
+        case ir::Instruction::PushStack:
+            return "ch_valcpy(&" + stack(ir) + ")";
+        default:
+            return boxed_literal(ir);
+        }
+    }
+
+    // Global holding the static `ch_string` `str`
+    std::string string(std::string const &str) {
+        if (strings.contains(str))
+            return strings.at(str);
+        std::string name{"__is" + std::to_string(strings.size())};
+        strings.emplace(str, name);
+        decls += "static ch_string const " + name + "=CH_STR_LITERAL(" +
+                 parser::quote_str(str) + ", " + std::to_string(str.size()) +
+                 ");\n";
+        return name;
+    }
+
+    // Global holding the value of `PushStack` `ir`
+    std::string stack(ir::Instruction const &ir) {
+        std::string build{};
+        for (auto const &elem :
+             std::get<std::vector<ir::Instruction>>(ir.value)) {
+            build += "ch_stk_push_back(&__id, " + value(elem) + ");\n";
+        }
+        if (names.contains(build))
+            return names.at(build);
+        std::string name{"__ic" + std::to_string(names.size())};
+        names.emplace(build, name);
+        decls += "static ch_value " + name + ";\n";
+        init += "{\nch_deque *__id = NULL;\n" + build + name +
+                "=ch_valof_stack(__id);\n}\n";
+        return name;
+    }
+};
+
+std::unordered_map<std::string, std::string> const comparisons{
+    {"<", "<"},   {">", ">"},   {"<=", "<="},
+    {"≤", "<="}, {">=", ">="}, {"≥", ">="}};
+
+// C condition comparing scalar `b` under `a`, has no value for builtins
+// other than the comparisons
+std::optional<std::string> compare_condition(std::string const &callee,
+                                             checks::Type::Kind under,
+                                             std::string const &b,
+                                             checks::Type::Kind top,
+                                             std::string const &a) {
+    // Same float promotion as the boxed comparisons
+    if (comparisons.contains(callee) && is_number(under) && is_number(top))
+        return "(float)" + b + comparisons.at(callee) + "(float)" + a;
+    if (callee == "=" || callee == "!=" || callee == "≠") {
+        bool equal = callee == "=";
+        if (under != top)
+            return equal ? "0" : "1";
+        return b + (equal ? "==" : "!=") + a;
+    }
+    return std::nullopt;
+}
+
+// A subroutine by the name of its static function
+struct Routine {
+    std::string name;
+    std::vector<ir::Instruction> body;
+};
+
+// Values of the current basic block that are not on the program stack yet,
+// held in `ch_value` locals so shuffles only rename them. Bottom first
+struct Pending {
+    std::vector<std::string> values{};
+    // Locals read from the top of the program stack, which still holds them,
+    // bottom first
+    std::vector<std::string> loaded{};
+    std::size_t locals{0};
+    // What is statically known of some locals: the subroutine a function
+    // value is, the literal an int is
+    std::unordered_map<std::string, Routine> routines{};
+    std::unordered_map<std::string, int> ints{};
+
+    std::string fresh() { return "__ir" + std::to_string(locals++); }
+
+    void push(std::string const &init, std::string &out) {
+        std::string value{fresh()};
+        out += value + "=" + init + ";\n";
+        values.emplace_back(value);
+    }
+
+    // Brings `takes` values into locals, reading the program stack for the
+    // ones below what is pending
+    void load(std::size_t takes, std::string &out) {
+        if (values.size() >= takes)
+            return;
+        std::size_t missing = takes - values.size();
+        out += "ch_stack_need(__istack, " +
+               std::to_string(loaded.size() + missing) + ");\n";
+        for (std::size_t i = 0; i < missing; ++i) {
+            std::string value{fresh()};
+            out += value + "=__istack->data[__istack->len-" +
+                   std::to_string(loaded.size() + 1) + "];\n";
+            values.insert(values.begin(), value);
+            loaded.insert(loaded.begin(), value);
+        }
+    }
+
+    void shuffle(ir::Shuffle const &shuffle, std::string &out) {
+        load(shuffle.takes, out);
+        std::size_t from = values.size() - shuffle.takes;
+        std::vector<std::string> taken{values.begin() + from, values.end()};
+        values.resize(from);
+        std::vector<bool> used(taken.size(), false);
+        for (auto i : shuffle.leaves) {
+            if (used[i]) {
+                std::string copy{fresh()};
+                out += copy + "=ch_valcpy(&" + taken[i] + ");\n";
+                values.emplace_back(copy);
+                if (routines.contains(taken[i]))
+                    routines.emplace(copy, routines.at(taken[i]));
+                if (ints.contains(taken[i]))
+                    ints.emplace(copy, ints.at(taken[i]));
+            } else {
+                used[i] = true;
+                values.emplace_back(taken[i]);
+            }
+        }
+        for (auto [i, value] : taken | std::ranges::views::enumerate) {
+            if (!used[i])
+                out += "ch_val_delete(&" + value + ");\n";
+        }
+    }
+
+    // Puts everything pending on the program stack, only rewriting the
+    // loaded slots that changed
+    void flush(std::string &out) {
+        std::size_t kept = std::min(loaded.size(), values.size());
+        for (std::size_t i = 0; i < kept; ++i) {
+            if (values[i] != loaded[i])
+                out += "__istack->data[__istack->len-" +
+                       std::to_string(loaded.size() - i) + "]=" + values[i] +
+                       ";\n";
+        }
+        if (loaded.size() > kept)
+            out += "__istack->len-=" + std::to_string(loaded.size() - kept) +
+                   ";\n";
+        for (std::size_t i = kept; i < values.size(); ++i) {
+            out += "ch_stack_push(__istack, " + values[i] + ");\n";
+        }
+        values.clear();
+        loaded.clear();
+    }
+};
+
+// Arities of the program's functions by mangled name, only those without
+// `...` arguments or returns
+struct Arity {
+    std::size_t args;
+    std::size_t rets;
+};
+using Arities = std::unordered_map<std::string, Arity>;
+
+// Arguments taken by the call at `i` of `fn` when it is a tail call: `fn`
+// exits right after with what the callee returns, so its frame can be left
+// before the call. Assumes mangled FN name
+std::optional<std::size_t> tail_call(traverser::Function const &fn,
+                                     std::size_t i, Arities const &arities) {
+    auto const &body = std::get<std::vector<ir::Instruction>>(fn.body);
+    if (body[i].kind != ir::Instruction::Call || i + 1 >= body.size() ||
+        body[i + 1].kind != ir::Instruction::Exit ||
+        !arities.contains(fn.name))
+        return std::nullopt;
+    auto callee = mangle(std::get<std::string>(body[i].value));
+    if (!arities.contains(callee) ||
+        arities.at(callee).rets != arities.at(fn.name).rets)
+        return std::nullopt;
+    return arities.at(callee).args;
+}
+
+// A call to the program's own function, which may leave a tail call behind in
+// `__istack` for the caller to run, see `CH_TAIL_CALL`
+std::string call(std::string const &mangled, Arities const &arities) {
+    if (arities.contains(mangled))
+        return "CH_CALL(" + mangled + ", __istack);\n";
+    return mangled + "(__istack);\n";
+}
+
+// Where the instructions being emitted come from: the function itself, or a
+// subroutine body inlined into it, which has no facts and jumps to `exit`
+// instead of returning
+struct Scope {
+    std::string subs;
+    std::string labels{};
+    std::optional<std::string> exit{};
+};
+
+// Literal `⋄` counts up to this are unrolled
+constexpr int unroll_limit = 4;
+
+// Literal pushes `fn` starts with when a `▭` right after boxes exactly them,
+// its frame being empty on entry
+std::optional<std::size_t> boxed_literals(traverser::Function const &fn) {
+    auto const &body = std::get<std::vector<ir::Instruction>>(fn.body);
+    if (fn.args.kind != parser::Argument::Limited || !fn.args.args.empty())
+        return std::nullopt;
+    std::size_t n = 0;
+    while (n < body.size() && evaluate::is_value(body[n])) {
+        ++n;
+    }
+    if (n == 0 || n == body.size() || body[n].kind != ir::Instruction::Call)
+        return std::nullopt;
+    auto callee = std::get<std::string>(body[n].value);
+    if (callee != "▭" && callee != "box")
+        return std::nullopt;
+    return n;
+}
+
 // Assumes mangled FN name
 void emit_native(traverser::Function fn, std::string &out,
+                 Constants &constants, BoxKinds const &box_kinds,
+                 Operands const &operands, Branches const &branches,
+                 Unreached const &unreached, Arities const &arities,
                  bool hijack = false) {
-    for (auto [i, ir] : std::get<std::vector<ir::Instruction>>(fn.body) |
-                            std::ranges::views::enumerate) {
+    Pending pending{};
+    std::string code{};
+    // Set by a tail call, making the `Exit` after it unreachable
+    bool tail = false;
+    bool self_tail = false;
+    std::function<void(ir::Instruction const &, std::size_t, Scope const &)>
+        emit;
+    std::size_t inlined = 0;
+    // Emits the body of a subroutine in place of calling it
+    auto inline_routine = [&](Routine const &routine) {
+        std::string tag{"__il" + std::to_string(inlined++)};
+        Scope inner{routine.name, tag + "_", tag + "_exit"};
+        for (auto [j, ir] : routine.body | std::ranges::views::enumerate) {
+            emit(ir, j, inner);
+        }
+        code += *inner.exit + ":;\n";
+    };
+    // The subroutine a pending function value `depth` below the top is
+    auto known_routine = [&](std::size_t depth) -> std::optional<Routine> {
+        if (pending.values.size() <= depth)
+            return std::nullopt;
+        auto value = pending.values[pending.values.size() - 1 - depth];
+        if (!pending.routines.contains(value))
+            return std::nullopt;
+        return pending.routines.at(value);
+    };
+    // A branch the checker decided: drops the `takes` values it tests and
+    // jumps to `label` or goes on
+    auto decided = [&](std::size_t takes, bool jumps,
+                       std::string const &label) {
+        for (std::size_t k = 0; k < takes; ++k) {
+            pending.shuffle(ir::shuffles.at("◌"), code);
+        }
+        if (jumps) {
+            pending.flush(code);
+            code += "goto " + label + ";\n";
+        }
+    };
+    emit = [&](ir::Instruction const &ir, std::size_t i, Scope const &scope) {
+        // Facts are keyed by the instructions of the function itself
+        bool facts = !scope.exit.has_value();
+        if (facts && unreached.contains(i))
+            return;
         switch (ir.kind) {
         case ir::Instruction::PushInt:
-            out += "ch_stk_push(&__istack, ch_valof_int(" +
-                   std::to_string(std::get<int>(ir.value)) + "));\n";
+            pending.push(boxed_literal(ir), code);
+            pending.ints.emplace(pending.values.back(),
+                                 std::get<int>(ir.value));
             break;
         case ir::Instruction::PushFloat:
-            out += "ch_stk_push(&__istack, ch_valof_float(" +
-                   std::to_string(std::get<float>(ir.value)) + "));\n";
-            break;
         case ir::Instruction::PushBool:
-            out += "ch_stk_push(&__istack, ch_valof_bool(" +
-                   std::to_string(std::get<bool>(ir.value)) + "));\n";
-            break;
         case ir::Instruction::PushChar:
-            out += "ch_stk_push(&__istack, ch_valof_char(" +
-                   std::to_string(std::get<char32_t>(ir.value)) + "));\n";
-            break;
-        case ir::Instruction::PushStr: {
-            out += "ch_stk_push(&__istack, ch_valof_string(ch_str_new(" +
-                   parser::quote_str(std::get<std::string>(ir.value)) +
-                   ")));\n";
+        case ir::Instruction::PushStr:
+        case ir::Instruction::PushStack:
+            pending.push(constants.value(ir), code);
             break;
-        }
         case ir::Instruction::Call: {
-            std::string tmp = get_temp();
-            out += "ch_stack_node*" + tmp + "=" +
-                   mangle(std::get<std::string>(ir.value)) + "(&__istack);\n";
-            out += "ch_stk_append(&__istack, " + tmp + ");\n";
+            auto callee = std::get<std::string>(ir.value);
+            if (ir::shuffles.contains(callee)) {
+                pending.shuffle(ir::shuffles.at(callee), code);
+                break;
+            }
+            if (callee == "▷" || callee == "ap") {
+                if (auto routine = known_routine(0)) {
+                    pending.values.pop_back();
+                    pending.flush(code);
+                    inline_routine(*routine);
+                    break;
+                }
+            }
+            if (callee == "⟜" || callee == "tail") {
+                if (auto routine = known_routine(0)) {
+                    pending.values.pop_back();
+                    pending.load(1, code);
+                    auto kept = pending.values.back();
+                    pending.values.pop_back();
+                    pending.flush(code);
+                    inline_routine(*routine);
+                    pending.values.emplace_back(kept);
+                    break;
+                }
+            }
+            if (callee == "⋄" || callee == "repeat") {
+                if (auto routine = known_routine(1)) {
+                    auto count = pending.values.back();
+                    pending.values.resize(pending.values.size() - 2);
+                    pending.flush(code);
+                    if (pending.ints.contains(count) &&
+                        pending.ints.at(count) <= unroll_limit) {
+                        for (int k = 0; k < pending.ints.at(count); ++k) {
+                            inline_routine(*routine);
+                        }
+                    } else {
+                        std::string k{"__ik" + std::to_string(inlined)};
+                        code += "for (int " + k + " = 0, " + k +
+                                "n = ch_valas_int(" + count + "); " + k +
+                                " < " + k + "n; ++" + k + ") {\n";
+                        inline_routine(*routine);
+                        code += "}\n";
+                    }
+                    break;
+                }
+            }
+            pending.flush(code);
+            if (auto args = hijack || !facts ? std::nullopt
+                                             : tail_call(fn, i, arities)) {
+                code += "ch_stack_leave(__istack, __ibase, " +
+                        std::to_string(*args) + ", 0);\n";
+                if (mangle(callee) == fn.name) {
+                    code += "goto __ientry;\n";
+                    self_tail = true;
+                } else {
+                    code += "CH_TAIL_CALL(" + mangle(callee) + ", __istack);\n";
+                }
+                tail = true;
+                break;
+            }
+            if (facts && operands.contains(i)) {
+                if (auto entry = typed_entry(callee, operands.at(i))) {
+                    code += *entry + "(__istack);\n";
+                    break;
+                }
+            }
+            if (facts && box_kinds.contains(i)) {
+                code += "ch_boxstk_as(__istack, " +
+                        value_kind(box_kinds.at(i)) + ");\n";
+                break;
+            }
+            code += call(mangle(callee), arities);
             break;
         }
         case ir::Instruction::JumpTrue: {
-            out += "if (ch_valas_bool(ch_stk_pop(&__istack))) goto " +
-                   std::get<std::string>(ir.value) + ";\n";
+            if (facts && branches.contains(i)) {
+                decided(1, branches.at(i),
+                        scope.labels + std::get<std::string>(ir.value));
+                break;
+            }
+            std::string cond{"ch_stack_pop(__istack)"};
+            if (!pending.values.empty()) {
+                cond = pending.values.back();
+                pending.values.pop_back();
+            }
+            pending.flush(code);
+            code += "if (ch_valas_bool(" + cond + ")) goto " + scope.labels +
+                    std::get<std::string>(ir.value) + ";\n";
+            break;
+        }
+        case ir::Instruction::JumpCompare: {
+            auto const &parts = std::get<std::vector<ir::Instruction>>(ir.value);
+            bool literal = parts.size() == 3;
+            if (facts && branches.contains(i)) {
+                decided(literal ? 1 : 2, branches.at(i),
+                        scope.labels +
+                            std::get<std::string>(parts.back().value));
+                break;
+            }
+            if (!facts || !operands.contains(i) ||
+                !is_scalar(operands.at(i).first) ||
+                !is_scalar(operands.at(i).second)) {
+                // Unknown kinds go through the generic builtin
+                for (auto const &part : parts) {
+                    emit(part, i, scope);
+                }
+                break;
+            }
+            auto [under, top] = operands.at(i);
+            pending.load(literal ? 1 : 2, code);
+            std::string a{};
+            if (literal) {
+                a = scalar_literal(parts.front()).second;
+            } else {
+                a = pending.values.back() + slot_field(top);
+                pending.values.pop_back();
+            }
+            std::string b{pending.values.back() + slot_field(under)};
+            pending.values.pop_back();
+            pending.flush(code);
+            auto callee = std::get<std::string>(parts[parts.size() - 2].value);
+            code += "if (" + *compare_condition(callee, under, b, top, a) +
+                    ") goto " + scope.labels +
+                    std::get<std::string>(parts.back().value) + ";\n";
             break;
         }
         case ir::Instruction::Subroutine: {
-            std::string sub = fn.name + "__i" + std::to_string(i);
-            out += "ch_stk_push(&__istack, ch_valof_function(&" + sub + "));\n";
+            std::string sub = scope.subs + "__i" + std::to_string(i);
+            pending.push("ch_valof_function(&" + sub + ")", code);
+            pending.routines.emplace(
+                pending.values.back(),
+                Routine{sub, std::get<std::vector<ir::Instruction>>(ir.value)});
             break;
         }
         case ir::Instruction::Goto: {
-            out += "goto " + std::get<std::string>(ir.value) + ";\n";
+            pending.flush(code);
+            code += "goto " + scope.labels + std::get<std::string>(ir.value) +
+                    ";\n";
             break;
         }
         case ir::Instruction::Label: {
-            out += std::get<std::string>(ir.value) + ":\n";
+            pending.flush(code);
+            code += scope.labels + std::get<std::string>(ir.value) + ":\n";
             break;
         }
         case ir::Instruction::Exit: {
-            if (hijack) {
-                out += "return __istack;\n";
-            } else {
-                auto tmp = get_temp();
-                out += "ch_stack_node*" + tmp + "=ch_stk_args(&__istack, " +
-                       std::to_string(fn.rets.args.size()) + ", " +
-                       std::to_string(fn.rets.rest.has_value()) + ");\n";
-                out += "ch_stk_delete(&__istack);\n";
-                out += "return " + tmp + ";\n";
+            if (tail) {
+                tail = false;
+                break;
+            }
+            pending.flush(code);
+            if (scope.exit) {
+                code += "goto " + *scope.exit + ";\n";
+                break;
             }
+            if (!hijack) {
+                code += "ch_stack_leave(__istack, __ibase, " +
+                        std::to_string(fn.rets.args.size()) + ", " +
+                        std::to_string(fn.rets.rest.has_value()) + ");\n";
+            }
+            code += "return;\n";
             break;
         }
         case ir::Instruction::GotoPos:
@@ -372,24 +944,401 @@ void emit_native(traverser::Function fn, std::string &out,
             assert(false && "Unreachable instruction");
             break;
         }
+    };
+    auto const &body = std::get<std::vector<ir::Instruction>>(fn.body);
+    std::size_t start = 0;
+    // A table the function starts by building is a constant stack, pushed
+    // without building it again
+    if (auto n = hijack ? std::nullopt : boxed_literals(fn)) {
+        std::vector<ir::Instruction> elems{body.begin(), body.begin() + *n};
+        std::ranges::reverse(elems);
+        pending.push(constants.value(
+                         ir::Instruction{ir::Instruction::PushStack, elems}),
+                     code);
+        start = *n + 1;
+    }
+    for (std::size_t i = start; i < body.size(); ++i) {
+        emit(body[i], i, Scope{fn.name});
+    }
+    for (std::size_t i = 0; i < pending.locals; ++i) {
+        out += "ch_value __ir" + std::to_string(i) + ";\n";
+    }
+    if (!hijack) {
+        out += "size_t __ibase;\n";
+        if (self_tail)
+            out += "__ientry:\n";
+        out += "__ibase = ch_stack_enter(__istack, " +
+               std::to_string(fn.args.args.size()) + ", " +
+               std::to_string(fn.args.kind == parser::Argument::Ellipses) +
+               ");\n";
+    }
+    out += code;
+}
+
+using Kinds = std::vector<checks::Type::Kind>;
+using FrameKinds = std::unordered_map<std::size_t, Kinds>;
+
+// C local holding frame slot `slot` while it has the scalar `kind`
+std::string slot_var(std::size_t slot, checks::Type::Kind kind) {
+    switch (kind) {
+    case checks::Type::Int:
+        return "__ii" + std::to_string(slot);
+    case checks::Type::Float:
+        return "__if" + std::to_string(slot);
+    case checks::Type::Char:
+        return "__ic" + std::to_string(slot);
+    case checks::Type::Bool:
+        return "__ib" + std::to_string(slot);
+    default:
+        assert(false && "Not a scalar kind");
+        return "";
+    }
+}
+
+std::string slot_ctype(checks::Type::Kind kind) {
+    switch (kind) {
+    case checks::Type::Float:
+        return "float";
+    case checks::Type::Bool:
+        return "char";
+    default:
+        return "int";
+    }
+}
+
+std::string slot_box(std::size_t slot, checks::Type::Kind kind) {
+    std::string var{slot_var(slot, kind)};
+    switch (kind) {
+    case checks::Type::Int:
+        return "ch_valof_int(" + var + ")";
+    case checks::Type::Float:
+        return "ch_valof_float(" + var + ")";
+    case checks::Type::Char:
+        return "ch_valof_char(" + var + ")";
+    default:
+        return "ch_valof_bool(" + var + ")";
     }
 }
 
+std::unordered_map<std::string, std::string> const arithmetic{
+    {"+", "+"}, {"-", "-"}, {"*", "*"}, {"/", "/"}};
+
+std::unordered_map<std::string, std::string> const type_names{
+    {"int", "CH_VALK_INT"},   {"float", "CH_VALK_FLOAT"},
+    {"char", "CH_VALK_CHAR"}, {"bool", "CH_VALK_BOOL"},
+    {"string", "CH_VALK_STRING"}, {"stack", "CH_VALK_STACK"}};
+
+// Emits `callee` directly on slot locals, giving the frame it leaves. Has no
+// value for calls that have to go through the runtime
+std::optional<Kinds> emit_typed_call(std::string const &callee,
+                                     Kinds const &frame, std::string &out) {
+    using K = checks::Type;
+    std::size_t depth = frame.size();
+    Kinds after{frame};
+
+    if (ir::shuffles.contains(callee)) {
+        auto const &[takes, leaves] = ir::shuffles.at(callee);
+        if (depth < takes)
+            return std::nullopt;
+        std::size_t from = depth - takes;
+        out += "{\n";
+        for (std::size_t i = 0; i < takes; ++i) {
+            if (std::ranges::find(leaves, i) == leaves.end())
+                continue;
+            out += slot_ctype(frame[from + i]) + " __iv" + std::to_string(i) +
+                   "=" + slot_var(from + i, frame[from + i]) + ";\n";
+        }
+        after.resize(from);
+        for (auto i : leaves) {
+            out += slot_var(after.size(), frame[from + i]) + "=__iv" +
+                   std::to_string(i) + ";\n";
+            after.emplace_back(frame[from + i]);
+        }
+        out += "}\n";
+        return after;
+    }
+
+    if (type_names.contains(callee)) {
+        out += slot_var(depth, K::Int) + "=" + type_names.at(callee) + ";\n";
+        after.emplace_back(K::Int);
+        return after;
+    }
+
+    if (depth < 1)
+        return std::nullopt;
+    auto top = frame[depth - 1];
+    std::string a{slot_var(depth - 1, top)};
+
+    if (callee == "print") {
+        out += "ch_stack_push(__istack, " + slot_box(depth - 1, top) + ");\n";
+        out += mangle(callee) + "(__istack);\n";
+        after.pop_back();
+        return after;
+    }
+    if ((callee == "!" || callee == "¬") && top == K::Bool) {
+        out += a + "=!" + a + ";\n";
+        return after;
+    }
+    if (callee == "ord" && top == K::Char) {
+        out += slot_var(depth - 1, K::Int) + "=" + a + ";\n";
+        after.back() = K::Int;
+        return after;
+    }
+    if (callee == "chr" && top == K::Int) {
+        out += slot_var(depth - 1, K::Char) + "=" + a + ";\n";
+        after.back() = K::Char;
+        return after;
+    }
+    if (callee == "type" || callee == "∈") {
+        out += slot_var(depth, K::Int) + "=" + value_kind(top) + ";\n";
+        after.emplace_back(K::Int);
+        return after;
+    }
+
+    if (depth < 2)
+        return std::nullopt;
+    auto under = frame[depth - 2];
+    std::string b{slot_var(depth - 2, under)};
+    after.pop_back();
+
+    if (arithmetic.contains(callee) && is_number(under) && is_number(top)) {
+        auto kind = under == K::Int && top == K::Int ? K::Int : K::Float;
+        out += slot_var(depth - 2, kind) + "=" + b + arithmetic.at(callee) +
+               a + ";\n";
+        after.back() = kind;
+        return after;
+    }
+    if (callee == "%" && under == K::Int && top == K::Int) {
+        out += b + "=" + b + "%" + a + ";\n";
+        return after;
+    }
+    if (auto cond = compare_condition(callee, under, b, top, a)) {
+        out += slot_var(depth - 2, K::Bool) + "=" + *cond + ";\n";
+        after.back() = K::Bool;
+        return after;
+    }
+    if ((callee == "&&" || callee == "∧" || callee == "||" ||
+         callee == "∨") &&
+        under == K::Bool && top == K::Bool) {
+        std::string op{callee == "&&" || callee == "∧" ? "&&" : "||"};
+        out += b + "=" + a + op + b + ";\n";
+        return after;
+    }
+
+    return std::nullopt;
+}
+
+// Emits a function whose frame only ever holds scalars with each slot in a C
+// local, fails on anything the checker's frames don't account for
+bool emit_typed(traverser::Function const &fn, std::string &out,
+                FrameKinds const &frames, Branches const &branches,
+                Arities const &arities) {
+    if (fn.args.kind == parser::Argument::Ellipses || fn.rets.rest)
+        return false;
+    auto const &body = std::get<std::vector<ir::Instruction>>(fn.body);
+    std::size_t nargs = fn.args.args.size();
+    if (!frames.contains(0) || frames.at(0).size() != nargs)
+        return false;
+
+    std::set<std::pair<std::size_t, checks::Type::Kind>> slots{};
+    auto use = [&slots](Kinds const &frame) {
+        for (auto [i, kind] : frame | std::ranges::views::enumerate) {
+            slots.emplace(i, kind);
+        }
+    };
+
+    std::string code{};
+    code += "size_t __ibase = ch_stack_enter(__istack, " +
+            std::to_string(nargs) + ", 0);\n";
+    for (std::size_t i = nargs; i > 0; --i) {
+        auto kind = frames.at(0)[i - 1];
+        code += slot_var(i - 1, kind) + "=ch_stack_pop(__istack)" +
+                slot_field(kind) + ";\n";
+    }
+    std::size_t entry = code.size();
+    bool tail = false;
+    bool self_tail = false;
+    // `tail_call` looks functions up by mangled name
+    auto mangled = traverser::Function{fn};
+    mangled.name = mangle(fn.name);
+    for (auto [i, ir] : body | std::ranges::views::enumerate) {
+        // Unreachable
+        if (!frames.contains(i))
+            continue;
+        if (ir.kind == ir::Instruction::Label) {
+            code += std::get<std::string>(ir.value) + ":\n";
+            continue;
+        }
+        auto const &frame = frames.at(i);
+        std::size_t depth = frame.size();
+        use(frame);
+        switch (ir.kind) {
+        case ir::Instruction::PushInt:
+        case ir::Instruction::PushFloat:
+        case ir::Instruction::PushBool:
+        case ir::Instruction::PushChar: {
+            auto [kind, value] = scalar_literal(ir);
+            code += slot_var(depth, kind) + "=" + value + ";\n";
+            break;
+        }
+        case ir::Instruction::Call: {
+            auto callee = std::get<std::string>(ir.value);
+            if (auto args = tail_call(mangled, i, arities)) {
+                if (depth < *args)
+                    return false;
+                std::size_t from = depth - *args;
+                Kinds passed{frame.begin() + from, frame.end()};
+                if (callee == fn.name && passed == frames.at(0)) {
+                    // Rebinds the arguments and starts over
+                    code += "{\n";
+                    for (std::size_t j = 0; j < *args; ++j) {
+                        code += slot_ctype(passed[j]) + " __iv" +
+                                std::to_string(j) + "=" +
+                                slot_var(from + j, passed[j]) + ";\n";
+                    }
+                    for (std::size_t j = 0; j < *args; ++j) {
+                        code += slot_var(j, passed[j]) + "=__iv" +
+                                std::to_string(j) + ";\n";
+                    }
+                    code += "}\ngoto __ientry;\n";
+                    tail = self_tail = true;
+                    break;
+                }
+                for (std::size_t slot = from; slot < depth; ++slot) {
+                    code += "ch_stack_push(__istack, " +
+                            slot_box(slot, frame[slot]) + ");\n";
+                }
+                code += "ch_stack_leave(__istack, __ibase, " +
+                        std::to_string(*args) + ", 0);\n";
+                code += "CH_TAIL_CALL(" + mangle(callee) + ", __istack);\n";
+                tail = true;
+                break;
+            }
+            if (!frames.contains(i + 1))
+                return false;
+            auto const &after = frames.at(i + 1);
+            if (auto left = emit_typed_call(callee, frame, code)) {
+                if (*left != after)
+                    return false;
+                break;
+            }
+            // Through the runtime with the whole frame spilled
+            for (auto [slot, kind] : frame | std::ranges::views::enumerate) {
+                code += "ch_stack_push(__istack, " + slot_box(slot, kind) +
+                        ");\n";
+            }
+            code += call(mangle(callee), arities);
+            for (std::size_t slot = after.size(); slot > 0; --slot) {
+                code += slot_var(slot - 1, after[slot - 1]) +
+                        "=ch_stack_pop(__istack)" +
+                        slot_field(after[slot - 1]) + ";\n";
+            }
+            use(after);
+            break;
+        }
+        case ir::Instruction::JumpTrue:
+            if (depth == 0 || frame.back() != checks::Type::Bool)
+                return false;
+            if (branches.contains(i)) {
+                if (branches.at(i))
+                    code += "goto " + std::get<std::string>(ir.value) + ";\n";
+                break;
+            }
+            code += "if (" + slot_var(depth - 1, checks::Type::Bool) +
+                    ") goto " + std::get<std::string>(ir.value) + ";\n";
+            break;
+        case ir::Instruction::JumpCompare: {
+            auto const &parts = std::get<std::vector<ir::Instruction>>(ir.value);
+            auto callee = std::get<std::string>(parts[parts.size() - 2].value);
+            bool literal = parts.size() == 3;
+            if (depth < (literal ? 1 : 2))
+                return false;
+            if (branches.contains(i)) {
+                if (branches.at(i))
+                    code += "goto " +
+                            std::get<std::string>(parts.back().value) + ";\n";
+                break;
+            }
+            std::size_t under = depth - (literal ? 1 : 2);
+            auto [top, a] =
+                literal ? scalar_literal(parts.front())
+                        : std::pair{frame[depth - 1],
+                                    slot_var(depth - 1, frame[depth - 1])};
+            auto cond = compare_condition(callee, frame[under],
+                                          slot_var(under, frame[under]), top, a);
+            if (!cond)
+                return false;
+            code += "if (" + *cond + ") goto " +
+                    std::get<std::string>(parts.back().value) + ";\n";
+            break;
+        }
+        case ir::Instruction::Goto:
+            code += "goto " + std::get<std::string>(ir.value) + ";\n";
+            break;
+        case ir::Instruction::Exit: {
+            if (tail) {
+                tail = false;
+                break;
+            }
+            std::size_t nrets = fn.rets.args.size();
+            if (depth < nrets)
+                return false;
+            for (std::size_t slot = depth - nrets; slot < depth; ++slot) {
+                code += "ch_stack_push(__istack, " +
+                        slot_box(slot, frame[slot]) + ");\n";
+            }
+            code += "ch_stack_leave(__istack, __ibase, " +
+                    std::to_string(nrets) + ", 0);\n";
+            code += "return;\n";
+            break;
+        }
+        case ir::Instruction::PushStr:
+        case ir::Instruction::PushStack:
+        case ir::Instruction::Subroutine:
+            return false;
+        case ir::Instruction::Label:
+        case ir::Instruction::GotoPos:
+        case ir::Instruction::LabelPos:
+            assert(false && "Unreachable instruction");
+            break;
+        }
+    }
+
+    if (self_tail)
+        code.insert(entry, "__ientry:\n");
+    for (auto [slot, kind] : slots) {
+        out += slot_ctype(kind) + " " + slot_var(slot, kind) + ";\n";
+    }
+    out += code;
+    return true;
+}
+
 std::string backend::c::make_c(Program prog, std::vector<std::string> includes,
-                               std::vector<parser::TypeDecl> type_decls) {
+                               std::vector<parser::TypeDecl> type_decls,
+                               checks::Facts const &facts) {
     std::string full{};
     full += "#include \"core.h\"\n";
     full += "#include \"stdlib.h\"\n";
     full += "#include \"stdio.h\"\n";
+    full += "#include \"math.h\"\n";
     for (auto &inc : includes) {
         full += "#include " + parser::quote_str(inc) + "\n";
     }
+    std::set<std::string> box_wrappers{};
+    Arities arities{};
+    for (auto const &fn : prog) {
+        if (fn.kind == traverser::Function::Native &&
+            fn.args.kind != parser::Argument::Ellipses && !fn.rets.rest) {
+            arities.emplace(mangle(fn.name), Arity{fn.args.args.size(),
+                                                   fn.rets.args.size()});
+        }
+    }
     for (auto fn : prog) {
         switch (fn.kind) {
         case traverser::Function::Native: {
             std::string name{mangle(fn.name)};
             auto body = std::get<std::vector<ir::Instruction>>(fn.body);
-            full += "ch_stack_node *" + name + "(ch_stack_node **);\n";
+            full += "void " + name + "(ch_stack *);\n";
             std::function<void(std::vector<ir::Instruction> &,
                                std::string name)>
                 generate_subs = [&generate_subs, &full](auto instrs,
@@ -397,8 +1346,7 @@ std::string backend::c::make_c(Program prog, std::vector<std::string> includes,
                     for (std::size_t i = 0; i < instrs.size(); ++i) {
                         if (instrs[i].kind == ir::Instruction::Subroutine) {
                             std::string sub = name + "__i" + std::to_string(i);
-                            full += "ch_stack_node *" + sub +
-                                    "(ch_stack_node **);\n";
+                            full += "static void " + sub + "(ch_stack *);\n";
                             generate_subs(
                                 std::get<std::vector<ir::Instruction>>(
                                     instrs[i].value),
@@ -410,50 +1358,53 @@ std::string backend::c::make_c(Program prog, std::vector<std::string> includes,
             break;
         }
         case traverser::Function::Foreign: {
-            full +=
-                "ch_stack_node *" + mangle(fn.name) + "(ch_stack_node **);\n";
+            full += "void " + mangle(fn.name) + "(ch_stack *);\n";
+            auto calls = box_calls(std::get<std::string>(fn.body));
+            box_wrappers.insert(calls.begin(), calls.end());
             break;
         }
         }
-
-        for (auto &decl : type_decls) {
-            full += "struct __it" + mangle(decl.name) + " {\n";
-            for (auto &[name, type] : decl.body) {
-                full += "ch_value " + mangle(name) + ";\n";
-            }
-            full += "};\n";
-            full += "static size_t __iti" + mangle(decl.name) + ";\n";
-            full +=
-                "ch_stack_node *" + mangle(decl.name) + "(ch_stack_node **);\n";
-            full += "ch_stack_node *" + mangle(decl.name + "!") +
-                    "(ch_stack_node **);\n";
-            full += "void * __icopy" + mangle(decl.name) + "(void const*);\n";
-            full += "void __idelete" + mangle(decl.name) + "(void *);\n";
-            for (auto &[name, _] : decl.body) {
-                full += "ch_stack_node *" + mangle(decl.name + "." + name) +
-                        "(ch_stack_node **);\n";
-                full += "ch_stack_node *" +
-                        mangle(decl.name + "." + name + "!") +
-                        "(ch_stack_node **);\n";
-            }
+    }
+    for (auto &decl : type_decls) {
+        full += "struct __it" + mangle(decl.name) + " {\n";
+        for (auto &[name, type] : decl.body) {
+            full += "ch_value " + mangle(name) + ";\n";
         }
+        full += "};\n";
+        full += "static size_t __iti" + mangle(decl.name) + ";\n";
+        full += "void " + mangle(decl.name) + "(ch_stack *);\n";
+        full += "void " + mangle(decl.name + "!") + "(ch_stack *);\n";
+        full += "void * __icopy" + mangle(decl.name) + "(void const*);\n";
+        full += "void __idelete" + mangle(decl.name) + "(void *);\n";
+        for (auto &[name, _] : decl.body) {
+            full += "void " + mangle(decl.name + "." + name) +
+                    "(ch_stack *);\n";
+            full += "void " + mangle(decl.name + "." + name + "!") +
+                    "(ch_stack *);\n";
+        }
+    }
+    for (auto &name : box_wrappers) {
+        emit_box_call(name, full);
     }
     full += "\n";
+    // The functions declare the constants they push here
+    std::size_t globals = full.size();
+    Constants constants{};
     for (auto fn : prog) {
         if (fn.kind == traverser::Function::Native) {
             auto body = std::get<std::vector<ir::Instruction>>(fn.body);
             std::function<void(std::vector<ir::Instruction> &, std::string)>
-                generate = [&full, &generate](auto instrs, std::string name) {
+                generate = [&full, &generate, &constants,
+                            &arities](auto instrs, std::string name) {
                     for (auto [i, ir] :
                          instrs | std::ranges::views::enumerate) {
                         if (ir.kind != ir::Instruction::Subroutine)
                             continue;
                         std::string fname = name + "__i" + std::to_string(i);
-                        full += "ch_stack_node *" + fname +
-                                "(ch_stack_node **__ifull) {\n";
-                        full += "ch_stack_node *__istack = ch_stk_new();\n";
-                        full += "ch_stk_append(&__istack, *__ifull);\n";
-                        full += "*__ifull = NULL;\n";
+                        // Subroutines share the caller's frame, calling one
+                        // touches nothing below the values it uses
+                        full += "static void " + fname +
+                                "(ch_stack *__istack) {\n";
                         emit_native(
                             traverser::Function{
                                 fname,
@@ -462,7 +1413,7 @@ std::string backend::c::make_c(Program prog, std::vector<std::string> includes,
                                 std::get<std::vector<ir::Instruction>>(
                                     ir.value),
                                 traverser::Function::Native},
-                            full, true);
+                            full, constants, {}, {}, {}, {}, arities, true);
                         full += "}\n";
                         generate(
                             std::get<std::vector<ir::Instruction>>(ir.value),
@@ -471,20 +1422,37 @@ std::string backend::c::make_c(Program prog, std::vector<std::string> includes,
                 };
             generate(body, mangle(fn.name));
         }
-        full += "ch_stack_node *" + mangle(fn.name) +
-                "(ch_stack_node **__ifull) {\n";
-        full += "ch_stack_node *__istack = ch_stk_args(__ifull, " +
-                std::to_string(fn.args.args.size()) + ", " +
-                std::to_string(fn.args.kind == parser::Argument::Ellipses) +
-                ");\n";
         switch (fn.kind) {
         case traverser::Function::Native: {
+            full += "void " + mangle(fn.name) + "(ch_stack *__istack) {\n";
+            auto branches = facts.branches.contains(fn.name)
+                                ? facts.branches.at(fn.name)
+                                : Branches{};
+            auto unreached = facts.unreached.contains(fn.name)
+                                 ? facts.unreached.at(fn.name)
+                                 : Unreached{};
+            if (facts.frame_kinds.contains(fn.name)) {
+                std::string typed{};
+                if (emit_typed(fn, typed, facts.frame_kinds.at(fn.name),
+                               branches, arities)) {
+                    full += typed;
+                    break;
+                }
+            }
             auto f = traverser::Function{fn};
             f.name = mangle(f.name);
-            emit_native(f, full);
+            emit_native(f, full, constants,
+                        facts.box_kinds.contains(fn.name)
+                            ? facts.box_kinds.at(fn.name)
+                            : BoxKinds{},
+                        facts.operand_kinds.contains(fn.name)
+                            ? facts.operand_kinds.at(fn.name)
+                            : Operands{},
+                        branches, unreached, arities);
             break;
         }
         case traverser::Function::Foreign:
+            full += "void " + mangle(fn.name) + "(ch_stack *__ifull) {\n";
             emit_foreign(fn, full);
             break;
         }
@@ -501,8 +1469,11 @@ std::string backend::c::make_c(Program prog, std::vector<std::string> includes,
                 mangle(name) + "), __idelete" + mangle(name) + ", __icopy" +
                 mangle(name) + ");\n";
     }
-    full += "ch_stack_node *stk = ch_stk_new();\n";
-    full += "__smain(&stk);\n";
+    full += constants.init;
+    full += "ch_stack stk = ch_stack_new();\n";
+    full += "CH_CALL(__smain, &stk);\n";
+    full += "ch_stack_delete(&stk);\n";
     full += "}\n";
+    full.insert(globals, constants.decls);
     return full;
 }
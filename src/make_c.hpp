@@ -1,5 +1,6 @@
 #pragma once
 
+#include "checks.hpp"
 #include "ir.hpp"
 #include "parser.hpp"
 #include "traverser.hpp"
@@ -8,5 +9,6 @@
 namespace backend::c {
 using Program = std::vector<traverser::Function>;
 std::string make_c(Program prog, std::vector<std::string> includes,
-                   std::vector<parser::TypeDecl> type_decls);
+                   std::vector<parser::TypeDecl> type_decls,
+                   checks::Facts const &facts);
 }; // namespace backend::c
@@ -0,0 +1,689 @@
+#include "passes.hpp"
+#include "dataflow.hpp"
+#include "evaluate.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <format>
+#include <functional>
+#include <map>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Builtins `JumpCompare` fuses with the branch on their result
+static std::unordered_set<std::string> const comparisons{
+    "<", ">", "<=", ">=", "≤", "≥", "=", "!=", "≠"};
+
+static bool is_literal(ir::Instruction const &instr) {
+    switch (instr.kind) {
+    case ir::Instruction::PushInt:
+    case ir::Instruction::PushFloat:
+    case ir::Instruction::PushChar:
+    case ir::Instruction::PushBool:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool is_comparison(ir::Instruction const &instr) {
+    return instr.kind == ir::Instruction::Call &&
+           comparisons.contains(std::get<std::string>(instr.value));
+}
+
+static bool is_call(ir::Instruction const &instr,
+                    std::unordered_set<std::string> const &names) {
+    return instr.kind == ir::Instruction::Call &&
+           names.contains(std::get<std::string>(instr.value));
+}
+
+static void on_subroutines(std::vector<ir::Instruction> &irs,
+                           void (*pass)(std::vector<ir::Instruction> &)) {
+    for (auto &instr : irs) {
+        if (instr.kind == ir::Instruction::Subroutine) {
+            pass(std::get<std::vector<ir::Instruction>>(instr.value));
+        }
+    }
+}
+
+std::vector<passes::Pass> passes::pipeline(int level,
+                                           effects::Table const &functions,
+                                           Callees const &callees) {
+    std::vector<Pass> pipeline{};
+    if (level >= 2) {
+        pipeline.emplace_back(
+            Pass{"inline-calls", [functions, &callees](auto &irs) {
+                     inline_calls(irs, callees, functions);
+                 }});
+        pipeline.emplace_back(Pass{"thread-jumps", thread_jumps});
+        pipeline.emplace_back(Pass{"clean-labels", clean_labels});
+        pipeline.emplace_back(Pass{"remove-unreachable", remove_unreachable});
+    }
+    if (level >= 1) {
+        pipeline.emplace_back(Pass{"fold-constants", fold_constants});
+    }
+    if (level >= 2) {
+        pipeline.emplace_back(Pass{"evaluate-calls", [&callees](auto &irs) {
+                                       evaluate_calls(irs, callees);
+                                   }});
+        pipeline.emplace_back(
+            Pass{"eliminate-dead-code", [functions](auto &irs) {
+                     eliminate_dead_code(irs, functions);
+                 }});
+    }
+    if (level >= 1) {
+        pipeline.emplace_back(Pass{"cancel-push-pop", cancel_push_pop});
+        pipeline.emplace_back(Pass{"simplify-shuffles", simplify_shuffles});
+        pipeline.emplace_back(
+            Pass{"fuse-compare-branches", fuse_compare_branches});
+    }
+    return pipeline;
+}
+
+std::size_t passes::count(std::vector<ir::Instruction> const &irs) {
+    std::size_t total = irs.size();
+    for (auto const &instr : irs) {
+        if (instr.kind == ir::Instruction::Subroutine) {
+            total += count(std::get<std::vector<ir::Instruction>>(instr.value));
+        }
+    }
+    return total;
+}
+
+void passes::fuse_compare_branches(std::vector<ir::Instruction> &irs) {
+    on_subroutines(irs, fuse_compare_branches);
+    std::vector<ir::Instruction> fused{};
+    for (std::size_t i = 0; i < irs.size(); ++i) {
+        auto &instr = irs[i];
+        if (is_comparison(instr) && i + 1 < irs.size() &&
+            irs[i + 1].kind == ir::Instruction::JumpTrue) {
+            std::vector<ir::Instruction> parts{};
+            if (!fused.empty() && is_literal(fused.back())) {
+                parts.emplace_back(fused.back());
+                fused.pop_back();
+            }
+            parts.emplace_back(instr);
+            parts.emplace_back(irs[++i]);
+            fused.emplace_back(
+                ir::Instruction{ir::Instruction::JumpCompare, parts});
+            continue;
+        }
+        fused.emplace_back(std::move(instr));
+    }
+    irs = std::move(fused);
+}
+
+static std::unordered_set<std::string> const equalities{"=", "!=", "≠"};
+
+static bool is_number(ir::Instruction const &instr) {
+    return instr.kind == ir::Instruction::PushInt ||
+           instr.kind == ir::Instruction::PushFloat;
+}
+
+// Ints promote to float like they do in the runtime's mixed arithmetic
+static float as_float(ir::Instruction const &instr) {
+    if (instr.kind == ir::Instruction::PushInt)
+        return static_cast<float>(std::get<int>(instr.value));
+    return std::get<float>(instr.value);
+}
+
+static std::optional<bool> order(std::string const &op, float a, float b) {
+    if (op == "<")
+        return a < b;
+    if (op == ">")
+        return a > b;
+    if (op == "<=" || op == "≤")
+        return a <= b;
+    if (op == ">=" || op == "≥")
+        return a >= b;
+    return std::nullopt;
+}
+
+// Same results as the runtime, nothing for what it would fail at or
+// overflow on
+static std::optional<ir::Instruction> fold_ints(std::string const &op, int a,
+                                                int b) {
+    int result{};
+    if (op == "+" && !__builtin_add_overflow(a, b, &result))
+        return ir::Instruction{ir::Instruction::PushInt, result};
+    if (op == "-" && !__builtin_sub_overflow(a, b, &result))
+        return ir::Instruction{ir::Instruction::PushInt, result};
+    if (op == "*" && !__builtin_mul_overflow(a, b, &result))
+        return ir::Instruction{ir::Instruction::PushInt, result};
+    if ((op == "/" || op == "%") && b != 0 && !(a == INT_MIN && b == -1))
+        return ir::Instruction{ir::Instruction::PushInt,
+                               op == "/" ? a / b : a % b};
+    if (equalities.contains(op))
+        return ir::Instruction{ir::Instruction::PushBool,
+                               (a == b) == (op == "=")};
+    return std::nullopt;
+}
+
+// Results that are not finite are left for the runtime to compute
+static std::optional<ir::Instruction> fold_floats(std::string const &op,
+                                                  float a, float b) {
+    std::optional<float> result{};
+    if (op == "+")
+        result = a + b;
+    else if (op == "-")
+        result = a - b;
+    else if (op == "*")
+        result = a * b;
+    else if (op == "/")
+        result = a / b;
+    if (!result || !std::isfinite(*result))
+        return std::nullopt;
+    return ir::Instruction{ir::Instruction::PushFloat, *result};
+}
+
+std::optional<ir::Instruction> passes::fold(std::string const &op,
+                                           ir::Instruction const &a,
+                                           ir::Instruction const &b) {
+    if (is_number(a) && is_number(b)) {
+        if (auto result = order(op, as_float(a), as_float(b)))
+            return ir::Instruction{ir::Instruction::PushBool, *result};
+        if (a.kind == ir::Instruction::PushInt &&
+            b.kind == ir::Instruction::PushInt)
+            return fold_ints(op, std::get<int>(a.value),
+                             std::get<int>(b.value));
+        if (a.kind == ir::Instruction::PushFloat &&
+            b.kind == ir::Instruction::PushFloat && equalities.contains(op))
+            return ir::Instruction{ir::Instruction::PushBool,
+                                   (std::get<float>(a.value) ==
+                                    std::get<float>(b.value)) == (op == "=")};
+        return fold_floats(op, as_float(a), as_float(b));
+    }
+    if (a.kind != b.kind)
+        return std::nullopt;
+    if (a.kind == ir::Instruction::PushChar && equalities.contains(op))
+        return ir::Instruction{ir::Instruction::PushBool,
+                               (std::get<char32_t>(a.value) ==
+                                std::get<char32_t>(b.value)) == (op == "=")};
+    if (a.kind == ir::Instruction::PushBool) {
+        bool x = std::get<bool>(a.value), y = std::get<bool>(b.value);
+        if (equalities.contains(op))
+            return ir::Instruction{ir::Instruction::PushBool,
+                                   (x == y) == (op == "=")};
+        if (op == "∧" || op == "&&")
+            return ir::Instruction{ir::Instruction::PushBool, x && y};
+        if (op == "∨" || op == "||")
+            return ir::Instruction{ir::Instruction::PushBool, x || y};
+    }
+    return std::nullopt;
+}
+
+void passes::fold_constants(std::vector<ir::Instruction> &irs) {
+    on_subroutines(irs, fold_constants);
+    std::vector<ir::Instruction> folded{};
+    for (auto &instr : irs) {
+        folded.emplace_back(std::move(instr));
+        if (folded.back().kind != ir::Instruction::Call)
+            continue;
+        auto op = std::get<std::string>(folded.back().value);
+        std::size_t n = folded.size();
+        if ((op == "¬" || op == "!") && n >= 2 &&
+            folded[n - 2].kind == ir::Instruction::PushBool) {
+            bool value = !std::get<bool>(folded[n - 2].value);
+            folded.resize(n - 2);
+            folded.emplace_back(
+                ir::Instruction{ir::Instruction::PushBool, value});
+        } else if (n >= 3 && is_literal(folded[n - 3]) &&
+                   is_literal(folded[n - 2])) {
+            if (auto result = fold(op, folded[n - 3], folded[n - 2])) {
+                folded.resize(n - 3);
+                folded.emplace_back(std::move(*result));
+            }
+        }
+    }
+    irs = std::move(folded);
+}
+
+static std::unordered_set<std::string> const pops{"◌", "pop"};
+
+static bool is_push(ir::Instruction const &instr) {
+    return is_literal(instr) || instr.kind == ir::Instruction::PushStr ||
+           instr.kind == ir::Instruction::PushStack ||
+           instr.kind == ir::Instruction::Subroutine;
+}
+
+void passes::cancel_push_pop(std::vector<ir::Instruction> &irs) {
+    on_subroutines(irs, cancel_push_pop);
+    std::vector<ir::Instruction> kept{};
+    for (auto &instr : irs) {
+        if (is_call(instr, pops) && !kept.empty() && is_push(kept.back())) {
+            kept.pop_back();
+            continue;
+        }
+        kept.emplace_back(std::move(instr));
+    }
+    irs = std::move(kept);
+}
+
+// What shuffles leave of the values they reach, bottom first. Values are
+// numbered by their depth below the top before the shuffles
+struct Shuffled {
+    std::size_t depth{0};
+    std::vector<std::size_t> stack{};
+
+    void apply(ir::Shuffle const &shuffle) {
+        while (stack.size() < shuffle.takes) {
+            stack.insert(stack.begin(), depth++);
+        }
+        std::size_t from = stack.size() - shuffle.takes;
+        std::vector<std::size_t> taken{stack.begin() + from, stack.end()};
+        stack.resize(from);
+        for (auto i : shuffle.leaves) {
+            stack.emplace_back(taken[i]);
+        }
+    }
+
+    // Reaches down to `to` values without moving them
+    void deepen(std::size_t to) {
+        while (depth < to) {
+            stack.insert(stack.begin(), depth++);
+        }
+    }
+
+    bool operator==(Shuffled const &) const = default;
+};
+
+// Names of the shuffles, in a fixed order so replacements are stable
+static std::map<std::string, ir::Shuffle> const ordered_shuffles{
+    ir::shuffles.begin(), ir::shuffles.end()};
+
+// The instructions with the same effect as the shuffles `run`, when fewer
+static std::optional<std::vector<ir::Instruction>>
+shorten(std::vector<ir::Instruction> const &run) {
+    Shuffled effect{};
+    for (auto const &instr : run) {
+        effect.apply(ir::shuffles.at(std::get<std::string>(instr.value)));
+    }
+    Shuffled none{};
+    none.deepen(effect.depth);
+    if (effect == none)
+        return std::vector<ir::Instruction>{};
+    for (auto const &[name, shuffle] : ordered_shuffles) {
+        if (shuffle.takes > effect.depth)
+            continue;
+        Shuffled single{};
+        single.apply(shuffle);
+        single.deepen(effect.depth);
+        if (single == effect)
+            return std::vector<ir::Instruction>{
+                ir::Instruction{ir::Instruction::Call, name}};
+    }
+    return std::nullopt;
+}
+
+static bool is_shuffle(ir::Instruction const &instr) {
+    return instr.kind == ir::Instruction::Call &&
+           ir::shuffles.contains(std::get<std::string>(instr.value));
+}
+
+void passes::simplify_shuffles(std::vector<ir::Instruction> &irs) {
+    on_subroutines(irs, simplify_shuffles);
+    std::vector<ir::Instruction> simplified{};
+    for (std::size_t i = 0; i < irs.size();) {
+        std::size_t end = i;
+        while (end < irs.size() && is_shuffle(irs[end])) {
+            ++end;
+        }
+        // Longest run from `i` that shortens
+        bool shortened = false;
+        for (std::size_t to = end; to > i + 1 && !shortened; --to) {
+            std::vector<ir::Instruction> run{irs.begin() + i,
+                                             irs.begin() + to};
+            if (auto replacement = shorten(run)) {
+                simplified.insert(simplified.end(), replacement->begin(),
+                                  replacement->end());
+                i = to;
+                shortened = true;
+            }
+        }
+        if (!shortened) {
+            simplified.emplace_back(std::move(irs[i]));
+            ++i;
+        }
+    }
+    bool changed = simplified.size() < irs.size();
+    irs = std::move(simplified);
+    if (changed) {
+        // A removed run can join the shuffles around it
+        simplify_shuffles(irs);
+    }
+}
+
+void passes::thread_jumps(std::vector<ir::Instruction> &irs) {
+    on_subroutines(irs, thread_jumps);
+    std::unordered_map<std::string, std::size_t> labels{};
+    for (auto [i, instr] : irs | std::ranges::views::enumerate) {
+        if (instr.kind == ir::Instruction::Label)
+            labels.emplace(std::get<std::string>(instr.value), i);
+    }
+    // First instruction run when jumping to `label`
+    auto landing = [&](std::string const &label) -> ir::Instruction const * {
+        std::size_t i = labels.at(label);
+        while (i < irs.size() && irs[i].kind == ir::Instruction::Label) {
+            ++i;
+        }
+        return i < irs.size() ? &irs[i] : nullptr;
+    };
+    // Follows `Goto`s from `label`, stopping at a cycle
+    auto resolve = [&](std::string label) {
+        std::unordered_set<std::string> seen{label};
+        while (auto next = landing(label)) {
+            if (next->kind != ir::Instruction::Goto)
+                break;
+            auto const &target = std::get<std::string>(next->value);
+            if (!seen.emplace(target).second)
+                break;
+            label = target;
+        }
+        return label;
+    };
+    for (auto &instr : irs) {
+        auto target = ir::jump_target(instr);
+        if (!target || !labels.contains(*target))
+            continue;
+        *target = resolve(*target);
+        auto next = landing(*target);
+        if (instr.kind == ir::Instruction::Goto && next &&
+            next->kind == ir::Instruction::Exit) {
+            instr = ir::Instruction{ir::Instruction::Exit, {}};
+        }
+    }
+}
+
+void passes::clean_labels(std::vector<ir::Instruction> &irs) {
+    on_subroutines(irs, clean_labels);
+    bool changed = true;
+    while (changed) {
+        std::unordered_set<std::string> targets{};
+        for (auto &instr : irs) {
+            if (auto target = ir::jump_target(instr))
+                targets.emplace(*target);
+        }
+        std::vector<ir::Instruction> kept{};
+        bool reachable = true;
+        for (std::size_t i = 0; i < irs.size(); ++i) {
+            auto &instr = irs[i];
+            if (instr.kind == ir::Instruction::Label) {
+                if (targets.contains(std::get<std::string>(instr.value))) {
+                    reachable = true;
+                    kept.emplace_back(std::move(instr));
+                }
+                continue;
+            }
+            if (!reachable)
+                continue;
+            if (instr.kind == ir::Instruction::Goto) {
+                auto const &target = std::get<std::string>(instr.value);
+                bool next = false;
+                for (std::size_t j = i + 1;
+                     j < irs.size() && irs[j].kind == ir::Instruction::Label;
+                     ++j) {
+                    next = next ||
+                           std::get<std::string>(irs[j].value) == target;
+                }
+                if (next)
+                    continue;
+            }
+            if (instr.kind == ir::Instruction::Goto ||
+                instr.kind == ir::Instruction::Exit)
+                reachable = false;
+            kept.emplace_back(std::move(instr));
+        }
+        changed = kept.size() < irs.size();
+        irs = std::move(kept);
+    }
+}
+
+void passes::remove_unreachable(std::vector<ir::Instruction> &irs) {
+    on_subroutines(irs, remove_unreachable);
+    auto cfg = dataflow::build_cfg(irs);
+    std::vector<ir::Instruction> kept{};
+    for (std::size_t b = 0; b < cfg.blocks.size(); ++b) {
+        if (!cfg.reachable[b])
+            continue;
+        for (std::size_t i = cfg.blocks[b].begin; i < cfg.blocks[b].end; ++i) {
+            kept.emplace_back(std::move(irs[i]));
+        }
+    }
+    irs = std::move(kept);
+}
+
+// Instruction of `irs` from `from` to `end` taking the value `depth` below
+// the top before `from`, nothing when it is not known there
+static std::optional<std::size_t>
+consumer(std::vector<ir::Instruction> const &irs, std::size_t from,
+         std::size_t end, std::size_t depth,
+         effects::Table const &functions) {
+    for (std::size_t i = from; i < end; ++i) {
+        auto effect = effects::of(irs[i], functions);
+        if (!effect)
+            return std::nullopt;
+        if (depth < effect->takes)
+            return i;
+        depth = depth - effect->takes + effect->leaves;
+    }
+    return std::nullopt;
+}
+
+void passes::eliminate_dead_code(std::vector<ir::Instruction> &irs,
+                                 effects::Table const &functions) {
+    for (auto &instr : irs) {
+        if (instr.kind == ir::Instruction::Subroutine) {
+            eliminate_dead_code(
+                std::get<std::vector<ir::Instruction>>(instr.value),
+                functions);
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        auto cfg = dataflow::build_cfg(irs);
+        auto live = dataflow::liveness(irs, cfg, functions);
+        // Pops to put in place of each instruction, nothing to keep it
+        std::vector<std::optional<std::size_t>> replaced(irs.size());
+        for (auto const &block : cfg.blocks) {
+            // One computation per block and round, the stack positions the
+            // others were found at may involve it
+            for (std::size_t i = block.begin; i < block.end; ++i) {
+                auto effect = effects::of(irs[i], functions);
+                if (!effect || !effect->pure || effect->leaves == 0 ||
+                    std::ranges::any_of(live[i], [](bool v) { return v; }))
+                    continue;
+                std::vector<std::size_t> drops{};
+                for (std::size_t depth = 0; depth < effect->leaves; ++depth) {
+                    auto j = consumer(irs, i + 1, block.end, depth, functions);
+                    if (!j || !is_call(irs[*j], pops))
+                        break;
+                    drops.emplace_back(*j);
+                }
+                if (drops.size() < effect->leaves)
+                    continue;
+                replaced[i] = effect->takes;
+                for (auto j : drops) {
+                    replaced[j] = 0;
+                }
+                changed = true;
+                break;
+            }
+        }
+        std::vector<ir::Instruction> kept{};
+        for (std::size_t i = 0; i < irs.size(); ++i) {
+            if (!replaced[i]) {
+                kept.emplace_back(std::move(irs[i]));
+                continue;
+            }
+            for (std::size_t k = 0; k < *replaced[i]; ++k) {
+                kept.emplace_back(ir::Instruction{ir::Instruction::Call, "◌"});
+            }
+        }
+        irs = std::move(kept);
+    }
+}
+
+// Callees up to this many instructions, not counting labels, are always
+// inlined, larger ones up to `inline_size` only with few call sites
+constexpr std::size_t inline_tiny = 8;
+constexpr std::size_t inline_size = 32;
+constexpr std::size_t inline_sites = 2;
+
+// Instructions in `irs` other than labels, counting those of subroutines
+static std::size_t weight(std::vector<ir::Instruction> const &irs) {
+    std::size_t total = 0;
+    for (auto const &instr : irs) {
+        if (instr.kind == ir::Instruction::Subroutine)
+            total +=
+                weight(std::get<std::vector<ir::Instruction>>(instr.value));
+        if (instr.kind != ir::Instruction::Label)
+            ++total;
+    }
+    return total;
+}
+
+// Adds the calls in `irs` to `sites`, counting those of subroutines
+static void count_calls(std::vector<ir::Instruction> const &irs,
+                        std::unordered_map<std::string, std::size_t> &sites) {
+    for (auto const &instr : irs) {
+        if (instr.kind == ir::Instruction::Call)
+            ++sites[std::get<std::string>(instr.value)];
+        else if (instr.kind == ir::Instruction::Subroutine)
+            count_calls(std::get<std::vector<ir::Instruction>>(instr.value),
+                        sites);
+    }
+}
+
+// Whether a copy of `callee` can replace a call to `name`. The frame a call
+// leaves holds only the returns, so every exit must have exactly those on
+// top of the arguments' place
+static bool inlinable(std::string const &name, passes::Callee const &callee,
+                      std::size_t sites, effects::Table const &functions) {
+    auto const &body = *callee.body;
+    std::size_t size = weight(body);
+    if (size > inline_size || (size > inline_tiny && sites > inline_sites))
+        return false;
+    std::unordered_map<std::string, std::size_t> calls{};
+    count_calls(body, calls);
+    if (calls.contains(name) || body.empty() ||
+        (body.back().kind != ir::Instruction::Exit &&
+         body.back().kind != ir::Instruction::Goto))
+        return false;
+    auto depths = dataflow::depths(body, dataflow::build_cfg(body), functions,
+                                   callee.args);
+    if (!depths)
+        return false;
+    for (std::size_t i = 0; i < body.size(); ++i) {
+        if (body[i].kind == ir::Instruction::Exit && (*depths)[i] &&
+            *(*depths)[i] != callee.rets)
+            return false;
+    }
+    return true;
+}
+
+void passes::inline_calls(std::vector<ir::Instruction> &irs,
+                          Callees const &callees,
+                          effects::Table const &functions) {
+    std::unordered_map<std::string, std::size_t> sites{};
+    for (auto const &[_, callee] : callees) {
+        count_calls(*callee.body, sites);
+    }
+    std::unordered_map<std::string, bool> eligible{};
+    std::function<void(std::vector<ir::Instruction> &)> splice =
+        [&](std::vector<ir::Instruction> &irs) {
+        std::unordered_set<std::string> labels{};
+        for (auto &instr : irs) {
+            if (instr.kind == ir::Instruction::Subroutine)
+                splice(std::get<std::vector<ir::Instruction>>(instr.value));
+            else if (instr.kind == ir::Instruction::Label)
+                labels.emplace(std::get<std::string>(instr.value));
+        }
+        std::size_t copies = 0;
+        std::vector<ir::Instruction> spliced{};
+        for (auto &instr : irs) {
+            auto callee = instr.kind == ir::Instruction::Call
+                              ? callees.find(std::get<std::string>(instr.value))
+                              : callees.end();
+            if (callee == callees.end() || callee->second.body == &irs) {
+                spliced.emplace_back(std::move(instr));
+                continue;
+            }
+            auto const &[name, target] = *callee;
+            auto known = eligible.find(name);
+            if (known == eligible.end())
+                known = eligible
+                            .emplace(name, inlinable(name, target, sites[name],
+                                                     functions))
+                            .first;
+            if (!known->second) {
+                spliced.emplace_back(std::move(instr));
+                continue;
+            }
+            // Labels of the copy get a prefix no label of `irs` starts with
+            std::string prefix{};
+            do {
+                prefix = std::format("I{}_", copies++);
+            } while (std::ranges::any_of(labels, [&](auto const &label) {
+                return label.starts_with(prefix);
+            }));
+            std::string end = prefix + "end";
+            bool jumps = false;
+            auto const &body = *target.body;
+            for (std::size_t i = 0; i < body.size(); ++i) {
+                auto copy = body[i];
+                if (copy.kind == ir::Instruction::Label) {
+                    copy.value = prefix + std::get<std::string>(copy.value);
+                } else if (auto label = ir::jump_target(copy)) {
+                    *label = prefix + *label;
+                } else if (copy.kind == ir::Instruction::Exit) {
+                    if (i + 1 == body.size())
+                        continue;
+                    copy = ir::Instruction{ir::Instruction::Goto, end};
+                    jumps = true;
+                }
+                spliced.emplace_back(std::move(copy));
+            }
+            if (jumps)
+                spliced.emplace_back(
+                    ir::Instruction{ir::Instruction::Label, end});
+        }
+        irs = std::move(spliced);
+    };
+    splice(irs);
+}
+
+void passes::evaluate_calls(std::vector<ir::Instruction> &irs,
+                            Callees const &callees) {
+    std::vector<ir::Instruction> evaluated{};
+    // Copies, so evaluating the function being rewritten still sees it whole
+    for (auto const &instr : irs) {
+        evaluated.emplace_back(instr);
+        auto &last = evaluated.back();
+        if (last.kind == ir::Instruction::Subroutine) {
+            evaluate_calls(std::get<std::vector<ir::Instruction>>(last.value),
+                           callees);
+            continue;
+        }
+        if (last.kind != ir::Instruction::Call)
+            continue;
+        auto callee = callees.find(std::get<std::string>(last.value));
+        if (callee == callees.end())
+            continue;
+        std::size_t args = callee->second.args;
+        if (evaluated.size() < args + 1 ||
+            !std::all_of(evaluated.end() - 1 - args, evaluated.end() - 1,
+                         evaluate::is_value))
+            continue;
+        std::vector<ir::Instruction> taken{evaluated.end() - 1 - args,
+                                           evaluated.end() - 1};
+        if (auto results = evaluate::call(callee->first, taken, callees)) {
+            evaluated.resize(evaluated.size() - 1 - args);
+            evaluated.insert(evaluated.end(), results->begin(), results->end());
+        }
+    }
+    irs = std::move(evaluated);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "effects.hpp"
+#include "ir.hpp"
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace passes {
+// A rewrite of a function's IR, also run on its subroutines
+struct Pass {
+    std::string name;
+    std::function<void(std::vector<ir::Instruction> &)> run;
+};
+
+// A native function of fixed arity the inliner may splice into its callers
+struct Callee {
+    std::size_t args;
+    std::size_t rets;
+    std::vector<ir::Instruction> const *body;
+};
+using Callees = std::unordered_map<std::string, Callee>;
+
+// Passes of optimization `level`, 0 to 2, in the order they run, for a
+// program of `functions`. The inliner reads the bodies of `callees` as the
+// pipeline rewrites them
+std::vector<Pass> pipeline(int level, effects::Table const &functions,
+                           Callees const &callees);
+
+// Instructions in `irs`, counting those of subroutines
+std::size_t count(std::vector<ir::Instruction> const &irs);
+
+// Fuses a comparison, optionally on a pushed literal, and the `?` branching
+// on its result into one `JumpCompare`
+void fuse_compare_branches(std::vector<ir::Instruction> &irs);
+
+// What `a b op` leaves for the literal pushes `a` and `b`, nothing when it
+// is not known without running it or the runtime would fail
+std::optional<ir::Instruction> fold(std::string const &op,
+                                    ir::Instruction const &a,
+                                    ir::Instruction const &b);
+
+// Computes arithmetic, comparisons and logic on pushed literals, leaving
+// the pushed result
+void fold_constants(std::vector<ir::Instruction> &irs);
+
+// Drops values pushed only to be popped right after
+void cancel_push_pop(std::vector<ir::Instruction> &irs);
+
+// Replaces runs of shuffles by the single shuffle with the same effect, or
+// by nothing when they leave the stack as it was
+void simplify_shuffles(std::vector<ir::Instruction> &irs);
+
+// Points jumps to a `Goto` at its target, and turns those to an `Exit` into
+// one
+void thread_jumps(std::vector<ir::Instruction> &irs);
+
+// Drops labels no jump targets, jumps to the next instruction and code that
+// follows a `Goto` or `Exit` without a label
+void clean_labels(std::vector<ir::Instruction> &irs);
+
+// Drops the blocks of the control flow graph the entry cannot reach
+void remove_unreachable(std::vector<ir::Instruction> &irs);
+
+// Drops pure computations whose results are only popped, with the pops,
+// popping their operands instead. See `dataflow::liveness`. Only run on
+// checked programs, the errors of the computations dropped go with them
+void eliminate_dead_code(std::vector<ir::Instruction> &irs,
+                         effects::Table const &functions);
+
+// Replaces calls to small `callees` by a copy of their body, with labels
+// renamed and exits jumping past the copy. Only callees that are not
+// recursive and leave exactly their returns on every exit are spliced.
+// Only run on checked programs, the copy no longer checks the arguments
+// against the callee's signature
+void inline_calls(std::vector<ir::Instruction> &irs, Callees const &callees,
+                  effects::Table const &functions);
+
+// Replaces calls to `callees` on pushed values by the values they return,
+// computed at compile time, see `evaluate::call`
+void evaluate_calls(std::vector<ir::Instruction> &irs, Callees const &callees);
+} // namespace passes